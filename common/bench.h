@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Keeps the compiler from dropping a value whose computation is being measured.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// How `MeasureNs` reports: a line per result for people, or one JSON object per line for scripts
+// comparing releases.
+enum class BenchFormat { kText, kJson };
+
+inline BenchFormat& OutputFormat() {
+    static BenchFormat format = BenchFormat::kText;
+    return format;
+}
+
+// Every benchmark's `main` starts here. `--json` switches the output to `BenchFormat::kJson`.
+inline void ParseBenchArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            OutputFormat() = BenchFormat::kJson;
+        }
+    }
+}
+
+// libstdc++ counts `std::shared_ptr` references non-atomically until the program starts its first
+// thread. Benchmarks against it call this first, so that it pays what a real server would.
+inline void StartAThread() {
+    std::thread([] {}).join();
+}
+
+// Prints one result in the format `ParseBenchArgs` chose.
+inline void PrintResult(const std::string& name, size_t iterations, double ns_per_op) {
+    if (OutputFormat() == BenchFormat::kJson) {
+        // Names are plain identifiers and spaces, nothing to escape
+        std::cout << "{\"name\": \"" << name << "\", \"iterations\": " << iterations
+                  << ", \"ns_per_op\": " << ns_per_op << ", \"ops_per_sec\": " << 1e9 / ns_per_op
+                  << "}" << std::endl;
+    } else {
+        std::cout << name << ": " << ns_per_op << " ns/op" << std::endl;
+    }
+}
+
+// Runs `body` `iterations` times and prints the average cost of one run.
+template <typename F>
+double MeasureNs(const std::string& name, size_t iterations, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        body();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    double ns_per_op = elapsed.count() / iterations;
+    PrintResult(name, iterations, ns_per_op);
+    return ns_per_op;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+// Readable form of a `typeid(...).name()`, or the name itself where the ABI can't tell
+inline std::string Demangle(const char* name) {
+#if __has_include(<cxxabi.h>)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (demangled) {
+        std::string result = demangled;
+        std::free(demangled);
+        return result;
+    }
+#endif
+    return name;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <common/demangle.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+// Registry of live control blocks and `RefCounted` objects, kept when SMART_PTRS_REGISTRY is
+// defined, to find out what a running process keeps resident.
+//
+// Each registered object embeds a `LiveNode` and links it into one of `kShards` intrusive lists,
+// picked by its address, so linking and unlinking take an uncontended lock and allocate
+// nothing. Blocks stay listed until the block itself is freed: one whose object is gone but
+// that weak references still keep shows up with no strong references.
+
+struct LiveEntry {
+    std::string type;
+    size_t strong = 0;
+    size_t weak = 0;
+    // The block and the object, not whatever the object owns
+    size_t bytes = 0;
+    // Innermost `LiveSite` of the thread that made the object, or null
+    const char* site = nullptr;
+};
+
+class LiveNode {
+public:
+    // Reports type and counts for the object at `owner`
+    using DescribeFn = void (*)(const void* owner, const std::type_info*& type, size_t& strong,
+                                size_t& weak);
+
+    // Owners link the node once constructed and unlink it before they go away. A copy of an
+    // object is a new object, linked by its own owner.
+    constexpr LiveNode() = default;
+    constexpr LiveNode(const LiveNode&) : LiveNode() {
+    }
+    LiveNode& operator=(const LiveNode&) {
+        return *this;
+    }
+
+    inline void Link(DescribeFn describe, const void* owner, size_t bytes);
+    inline void Unlink();
+
+private:
+    friend class LiveRegistry;
+
+    LiveNode* prev_ = nullptr;
+    LiveNode* next_ = nullptr;
+    DescribeFn describe_ = nullptr;
+    const void* owner_ = nullptr;
+    size_t bytes_ = 0;
+    const char* site_ = nullptr;
+};
+
+// Tags everything the current thread registers while it is in scope:
+//     LiveSite site("texture cache");
+// `name` must outlive the objects, e.g. a string literal. Works without SMART_PTRS_REGISTRY too,
+// with no effect.
+class LiveSite {
+public:
+    explicit LiveSite(const char* name) : previous_(current) {
+        current = name;
+    }
+    LiveSite(const LiveSite&) = delete;
+    LiveSite& operator=(const LiveSite&) = delete;
+    ~LiveSite() {
+        current = previous_;
+    }
+
+    static const char* Current() {
+        return current;
+    }
+
+private:
+    inline static thread_local const char* current = nullptr;
+
+    const char* previous_;
+};
+
+class LiveRegistry {
+public:
+    static constexpr size_t kShards = 64;
+
+    // Calls `callback(const LiveEntry&)` for every registered object. Entries of a shard are
+    // copied with its lock held and reported after it is released, so the callback may create
+    // and drop pointers freely. Objects created or freed meanwhile may or may not be reported.
+    // Counts are read without synchronizing with the owner threads: exact for the atomic
+    // counters, a snapshot that may be torn for single-threaded objects used elsewhere.
+    template <typename F>
+    static void ForEachLive(F&& callback) {
+        struct Raw {
+            const std::type_info* type;
+            size_t strong;
+            size_t weak;
+            size_t bytes;
+            const char* site;
+        };
+        std::vector<Raw> entries;
+        for (Shard& shard : GetShards()) {
+            entries.clear();
+            {
+                std::lock_guard lock(shard.mutex);
+                for (LiveNode* node = shard.head; node; node = node->next_) {
+                    Raw raw{nullptr, 0, 0, node->bytes_, node->site_};
+                    node->describe_(node->owner_, raw.type, raw.strong, raw.weak);
+                    entries.push_back(raw);
+                }
+            }
+            for (const Raw& raw : entries) {
+                callback(LiveEntry{Demangle(raw.type->name()), raw.strong, raw.weak, raw.bytes,
+                                   raw.site});
+            }
+        }
+    }
+
+private:
+    friend class LiveNode;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        LiveNode* head = nullptr;
+    };
+    struct Shards {
+        Shard* begin() {
+            return shards;
+        }
+        Shard* end() {
+            return shards + kShards;
+        }
+
+        Shard shards[kShards];
+    };
+
+    static Shard& ShardOf(const LiveNode* node) {
+        uint64_t hash = reinterpret_cast<uintptr_t>(node) * 0x9E3779B97F4A7C15;
+        return GetShards().shards[(hash >> 32) % kShards];
+    }
+
+    // Never destroyed: objects may be freed by destructors of other statics.
+    static Shards& GetShards() {
+        static Shards* shards = new Shards;
+        return *shards;
+    }
+};
+
+inline void LiveNode::Link(DescribeFn describe, const void* owner, size_t bytes) {
+    describe_ = describe;
+    owner_ = owner;
+    bytes_ = bytes;
+    site_ = LiveSite::Current();
+    auto& shard = LiveRegistry::ShardOf(this);
+    std::lock_guard lock(shard.mutex);
+    next_ = shard.head;
+    if (next_) {
+        next_->prev_ = this;
+    }
+    shard.head = this;
+}
+
+inline void LiveNode::Unlink() {
+    if (!describe_) {
+        return;
+    }
+    auto& shard = LiveRegistry::ShardOf(this);
+    std::lock_guard lock(shard.mutex);
+    if (prev_) {
+        prev_->next_ = next_;
+    } else {
+        shard.head = next_;
+    }
+    if (next_) {
+        next_->prev_ = prev_;
+    }
+    prev_ = next_ = nullptr;
+    describe_ = nullptr;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+
+// What went through a `RecordingAllocator` or the global `operator new`, for tests that check
+// how much memory something takes rather than how many allocations.
+struct AllocationRecord {
+    // Size classes are powers of two: class `i` holds requests of up to `2^i` bytes
+    static constexpr size_t kSizeClasses = 16;
+
+    size_t allocations = 0;
+    size_t bytes = 0;        // Requested in total
+    size_t live_bytes = 0;   // Requested and not given back yet
+    size_t peak_bytes = 0;   // Highest `live_bytes` seen
+    size_t largest = 0;      // Biggest single request
+    size_t max_align = 0;    // Strictest alignment asked for
+    size_t size_classes[kSizeClasses] = {};
+
+    static size_t SizeClass(size_t bytes) {
+        size_t size_class = 0;
+        while (size_class + 1 < kSizeClasses && (size_t{1} << size_class) < bytes) {
+            ++size_class;
+        }
+        return size_class;
+    }
+
+    void OnAllocate(size_t size, size_t align) {
+        ++allocations;
+        bytes += size;
+        live_bytes += size;
+        peak_bytes = std::max(peak_bytes, live_bytes);
+        largest = std::max(largest, size);
+        max_align = std::max(max_align, align);
+        ++size_classes[SizeClass(size)];
+    }
+    void OnDeallocate(size_t size) {
+        live_bytes -= size;
+    }
+};
+
+// `std::allocator` that reports every request to an `AllocationRecord`
+template <typename T>
+struct RecordingAllocator {
+    using value_type = T;
+
+    explicit RecordingAllocator(AllocationRecord* record) : record(record) {
+    }
+    template <typename U>
+    RecordingAllocator(const RecordingAllocator<U>& other) : record(other.record) {
+    }
+
+    T* allocate(size_t n) {
+        record->OnAllocate(n * sizeof(T), alignof(T));
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) {
+        record->OnDeallocate(n * sizeof(T));
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const RecordingAllocator<U>& other) const {
+        return record == other.record;
+    }
+    template <typename U>
+    bool operator!=(const RecordingAllocator<U>& other) const {
+        return record != other.record;
+    }
+
+    AllocationRecord* record;
+};
+
+// Charges the global allocations and frees of the current thread to `record` while in scope.
+// Only takes effect in a program linked with `recording_new`, which replaces the global
+// `operator new` and `operator delete`, so it can't be linked with anything else that does, such
+// as `allocations_checker`.
+class RecordingScope {
+public:
+    explicit RecordingScope(AllocationRecord* record) : previous_(current) {
+        current = record;
+    }
+    RecordingScope(const RecordingScope&) = delete;
+    RecordingScope& operator=(const RecordingScope&) = delete;
+    ~RecordingScope() {
+        current = previous_;
+    }
+
+    static AllocationRecord* Current() {
+        return current;
+    }
+
+private:
+    inline static thread_local AllocationRecord* current = nullptr;
+
+    AllocationRecord* previous_;
+};
+
+// Runs `X` with its global allocations recorded, then checks them, in the style of the
+// `EXPECT_*` checks of `allocations_checker`. Objects `X` makes and keeps are not freed yet.
+#define EXPECT_RECORDED(X, CONDITION)                   \
+    do {                                                \
+        AllocationRecord recorded;                      \
+        {                                               \
+            RecordingScope recording_scope(&recorded);  \
+            X;                                          \
+        }                                               \
+        REQUIRE(CONDITION);                             \
+    } while (0)
+// At most `N` bytes asked for in total
+#define EXPECT_AT_MOST_BYTES(X, N) EXPECT_RECORDED(X, recorded.bytes <= (N))
+// No single request for more than `N` bytes
+#define EXPECT_NO_ALLOCATION_LARGER_THAN(X, N) EXPECT_RECORDED(X, recorded.largest <= (N))
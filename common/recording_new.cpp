@@ -0,0 +1,118 @@
+#include "recording_allocator.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Every block starts with a header holding its size and the record it was charged to. A free
+// is charged back only while that record is still the current one.
+namespace recording_new {
+
+struct Header {
+    size_t size;
+    AllocationRecord* record;
+};
+
+void* Allocate(size_t size, size_t align) {
+    size_t offset = std::max(align, alignof(std::max_align_t));
+    static_assert(sizeof(Header) <= alignof(std::max_align_t));
+    size_t total = (offset + size + offset - 1) / offset * offset;
+    void* base = align > alignof(std::max_align_t) ? std::aligned_alloc(offset, total)
+                                                   : std::malloc(total);
+    if (!base) {
+        throw std::bad_alloc();
+    }
+    void* memory = static_cast<char*>(base) + offset;
+    auto* header = static_cast<Header*>(memory) - 1;
+    header->size = size;
+    header->record = RecordingScope::Current();
+    if (header->record) {
+        header->record->OnAllocate(size, align);
+    }
+    return memory;
+}
+
+void Deallocate(void* memory, size_t align) {
+    if (!memory) {
+        return;
+    }
+    auto* header = static_cast<Header*>(memory) - 1;
+    if (header->record && header->record == RecordingScope::Current()) {
+        header->record->OnDeallocate(header->size);
+    }
+    std::free(static_cast<char*>(memory) - std::max(align, alignof(std::max_align_t)));
+}
+
+}  // namespace recording_new
+
+// All forms are replaced: a library may provide its own for any it isn't given
+void* operator new(size_t size) {
+    return recording_new::Allocate(size, alignof(std::max_align_t));
+}
+void* operator new[](size_t size) {
+    return recording_new::Allocate(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t align) {
+    return recording_new::Allocate(size, static_cast<size_t>(align));
+}
+void* operator new[](size_t size, std::align_val_t align) {
+    return recording_new::Allocate(size, static_cast<size_t>(align));
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return recording_new::Allocate(size, alignof(std::max_align_t));
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    try {
+        return recording_new::Allocate(size, static_cast<size_t>(align));
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return operator new(size, align, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept {
+    recording_new::Deallocate(memory, alignof(std::max_align_t));
+}
+void operator delete[](void* memory) noexcept {
+    recording_new::Deallocate(memory, alignof(std::max_align_t));
+}
+void operator delete(void* memory, size_t) noexcept {
+    recording_new::Deallocate(memory, alignof(std::max_align_t));
+}
+void operator delete[](void* memory, size_t) noexcept {
+    recording_new::Deallocate(memory, alignof(std::max_align_t));
+}
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    recording_new::Deallocate(memory, alignof(std::max_align_t));
+}
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    recording_new::Deallocate(memory, alignof(std::max_align_t));
+}
+void operator delete(void* memory, std::align_val_t align) noexcept {
+    recording_new::Deallocate(memory, static_cast<size_t>(align));
+}
+void operator delete[](void* memory, std::align_val_t align) noexcept {
+    recording_new::Deallocate(memory, static_cast<size_t>(align));
+}
+void operator delete(void* memory, size_t, std::align_val_t align) noexcept {
+    recording_new::Deallocate(memory, static_cast<size_t>(align));
+}
+void operator delete[](void* memory, size_t, std::align_val_t align) noexcept {
+    recording_new::Deallocate(memory, static_cast<size_t>(align));
+}
+void operator delete(void* memory, std::align_val_t align, const std::nothrow_t&) noexcept {
+    recording_new::Deallocate(memory, static_cast<size_t>(align));
+}
+void operator delete[](void* memory, std::align_val_t align, const std::nothrow_t&) noexcept {
+    recording_new::Deallocate(memory, static_cast<size_t>(align));
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+// Reference counting statistics per pointee type, recorded when SMART_PTRS_TRACE is defined.
+// Without it the hooks expand to nothing and only `TraceEvent` is declared.
+//
+// Every thread counts into a table of its own with plain relaxed stores. `GetStats` and
+// `DumpStats` add up the tables of running threads and the totals left by exited ones.
+
+enum class TraceEvent {
+    kConstruct,    // A pointer took ownership of a new object
+    kCopy,         // A pointer was copied
+    kMove,         // A pointer was moved
+    kIncrement,    // A strong or weak count went up
+    kDecrement,    // A strong or weak count went down
+    kLock,         // A weak pointer was asked for a strong one
+    kLockFailure,  // ... and the object was gone
+    kCount,
+};
+
+#ifdef SMART_PTRS_TRACE
+
+#include <common/demangle.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#define SMART_PTRS_TRACE_EVENT(Type, event) RefTrace::Record<Type>(TraceEvent::event)
+
+class RefTrace {
+public:
+    static constexpr size_t kEvents = static_cast<size_t>(TraceEvent::kCount);
+    // Types past this share the last slot
+    static constexpr size_t kMaxTypes = 256;
+
+    struct TypeStats {
+        std::string type;
+        uint64_t counts[kEvents] = {};
+
+        uint64_t operator[](TraceEvent event) const {
+            return counts[static_cast<size_t>(event)];
+        }
+    };
+
+    // `T`, `const T` and `T[]` count into the same row
+    template <typename T>
+    static void Record(TraceEvent event) {
+        Bump(TypeIndex<std::remove_cv_t<std::remove_extent_t<T>>>(), static_cast<size_t>(event));
+    }
+
+    // Types with any events, busiest first
+    static std::vector<TypeStats> GetStats() {
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        std::vector<TypeStats> stats(central.names.size());
+        for (size_t type = 0; type < stats.size(); ++type) {
+            stats[type].type = central.names[type];
+            for (size_t event = 0; event < kEvents; ++event) {
+                stats[type].counts[event] = central.retired[type][event];
+                for (ThreadTable* table : central.tables) {
+                    stats[type].counts[event] +=
+                        table->counts[type][event].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        stats.erase(std::remove_if(stats.begin(), stats.end(), [](const TypeStats& type) {
+                        return std::all_of(std::begin(type.counts), std::end(type.counts),
+                                           [](uint64_t count) { return !count; });
+                    }), stats.end());
+        std::sort(stats.begin(), stats.end(), [](const TypeStats& left, const TypeStats& right) {
+            return Traffic(left) > Traffic(right);
+        });
+        return stats;
+    }
+
+    static void DumpStats(std::ostream& out) {
+        static constexpr const char* kColumns[kEvents] = {"construct", "copy",      "move",
+                                                          "increment", "decrement", "lock",
+                                                          "lock_fail"};
+        out << std::left << std::setw(40) << "type" << std::right;
+        for (const char* column : kColumns) {
+            out << std::setw(12) << column;
+        }
+        out << '\n';
+        for (const TypeStats& type : GetStats()) {
+            out << std::left << std::setw(40) << type.type << std::right;
+            for (uint64_t count : type.counts) {
+                out << std::setw(12) << count;
+            }
+            out << '\n';
+        }
+    }
+
+private:
+    struct ThreadTable {
+        ThreadTable();
+        ~ThreadTable();
+
+        // Written by the owner thread only
+        std::atomic<uint64_t> counts[kMaxTypes][kEvents] = {};
+    };
+
+    struct Central {
+        std::mutex mutex;
+        std::vector<std::string> names;
+        std::vector<ThreadTable*> tables;
+        uint64_t retired[kMaxTypes][kEvents] = {};  // Counts of threads that have exited
+    };
+
+    static uint64_t Traffic(const TypeStats& type) {
+        return type[TraceEvent::kIncrement] + type[TraceEvent::kDecrement];
+    }
+
+    template <typename T>
+    static size_t TypeIndex() {
+        static const size_t index = Register(Demangle(typeid(T).name()));
+        return index;
+    }
+
+    static size_t Register(std::string name) {
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        if (central.names.size() == kMaxTypes - 1) {
+            central.names.push_back("<other types>");
+        }
+        if (central.names.size() == kMaxTypes) {
+            return kMaxTypes - 1;
+        }
+        central.names.push_back(std::move(name));
+        return central.names.size() - 1;
+    }
+
+    static void Bump(size_t type, size_t event) {
+        if (ThreadTable* table = GetThreadTable()) {
+            auto& count = table->counts[type][event];
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            std::lock_guard lock(GetCentral().mutex);
+            ++GetCentral().retired[type][event];
+        }
+    }
+
+    // Never destroyed: pointers may be traced from destructors of other statics.
+    static Central& GetCentral() {
+        static Central* central = new Central;
+        return *central;
+    }
+    static ThreadTable* GetThreadTable() {
+        static thread_local ThreadTable table;
+        return table_alive ? &table : nullptr;
+    }
+
+    // Trivially destructible, so events on an exiting thread after its table is gone still see it
+    inline static thread_local bool table_alive = false;
+};
+
+inline RefTrace::ThreadTable::ThreadTable() {
+    std::lock_guard lock(GetCentral().mutex);
+    GetCentral().tables.push_back(this);
+    table_alive = true;
+}
+
+inline RefTrace::ThreadTable::~ThreadTable() {
+    Central& central = GetCentral();
+    std::lock_guard lock(central.mutex);
+    table_alive = false;
+    for (size_t type = 0; type < kMaxTypes; ++type) {
+        for (size_t event = 0; event < kEvents; ++event) {
+            central.retired[type][event] += counts[type][event].load(std::memory_order_relaxed);
+        }
+    }
+    central.tables.erase(std::find(central.tables.begin(), central.tables.end(), this));
+}
+
+#else
+
+#define SMART_PTRS_TRACE_EVENT(Type, event) static_cast<void>(0)
+
+#endif
@@ -0,0 +1,45 @@
+#include "intrusive.h"
+
+#include <common/bench.h>
+
+#include <memory>
+#include <utility>
+
+// `IntrusivePtr` next to `std::shared_ptr` to an object made by `std::make_shared`, the closest
+// standard equivalent.
+
+constexpr size_t kAllocIterations = 5'000'000;
+constexpr size_t kIterations = 50'000'000;
+
+struct Counted : SimpleRefCounted<Counted> {
+    int value = 42;
+};
+
+template <typename Ptr, typename Make>
+void BenchIntrusive(const std::string& name, Make make) {
+    MeasureNs(name + " make/destroy", kAllocIterations, [&make] {
+        Ptr ptr = make();
+        DoNotOptimize(ptr);
+    });
+
+    Ptr ptr = make();
+    MeasureNs(name + " copy/destroy", kIterations, [&ptr] {
+        Ptr copy(ptr);
+        DoNotOptimize(copy);
+    });
+
+    Ptr other;
+    MeasureNs(name + " move", kIterations, [&ptr, &other] {
+        other = std::move(ptr);
+        ptr = std::move(other);
+        DoNotOptimize(ptr);
+    });
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    StartAThread();
+    BenchIntrusive<IntrusivePtr<Counted>>("IntrusivePtr", [] { return MakeIntrusive<Counted>(); });
+    BenchIntrusive<std::shared_ptr<Counted>>("std::shared_ptr",
+                                             [] { return std::make_shared<Counted>(); });
+}
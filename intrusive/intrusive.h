@@ -1,5 +1,11 @@
 #pragma once
 
+#include <common/ref_trace.h>
+
+#ifdef SMART_PTRS_REGISTRY
+#include <common/live_registry.h>
+#endif
+
 #include <cstddef>  // for std::nullptr_t
 #include <utility>  // for std::exchange / std::swap
 
@@ -29,8 +35,20 @@ struct DefaultDelete {
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
+#ifdef SMART_PTRS_REGISTRY
+    RefCounted() {
+        live_.Link(&DescribeLive, this, sizeof(Derived));
+    }
+    RefCounted(const RefCounted& other) : counter_(other.counter_) {
+        live_.Link(&DescribeLive, this, sizeof(Derived));
+    }
+    ~RefCounted() {
+        live_.Unlink();
+    }
+#endif
     // Increase reference counter.
     void IncRef() {
+        SMART_PTRS_TRACE_EVENT(Derived, kIncrement);
         counter_.IncRef();
     };
     RefCounted& operator=(const RefCounted& other) {
@@ -39,6 +57,7 @@ public:
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
+        SMART_PTRS_TRACE_EVENT(Derived, kDecrement);
         if (!counter_.DecRef()) {
             Deleter::Destroy(static_cast<Derived*>(this));
         }
@@ -51,11 +70,109 @@ public:
 
 private:
     Counter counter_;
+#ifdef SMART_PTRS_REGISTRY
+    LiveNode live_;
+
+    static void DescribeLive(const void* owner, const std::type_info*& type, size_t& strong,
+                             size_t&) {
+        type = &typeid(Derived);
+        strong = static_cast<const RefCounted*>(owner)->RefCount();
+    }
+#endif
 };
 
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+// Side table of an object that is referenced weakly. It is kept alive by the weak references
+// and by the object itself, and is told when the object goes away.
+struct IntrusiveWeakBlock {
+    void DecWeak() {
+        if (!--weak_count) {
+            delete this;
+        }
+    }
+
+    bool alive = true;
+    size_t weak_count = 1;
+};
+
+// Same as `RefCounted`, but the object can also be referenced by `IntrusiveWeakPtr`.
+// The side block is only allocated for the first weak reference, until then it costs one
+// pointer. Like `SimpleCounter`, weak references are not thread-safe.
+template <typename Derived, typename Counter = SimpleCounter, typename Deleter = DefaultDelete>
+class RefCountedWithWeak {
+public:
+    RefCountedWithWeak() {
+        LinkLive();
+    }
+    // A copy is a new object: weak references to the original do not see it
+    RefCountedWithWeak(const RefCountedWithWeak&) {
+        LinkLive();
+    }
+    RefCountedWithWeak& operator=(const RefCountedWithWeak&) {
+        return *this;
+    };
+    ~RefCountedWithWeak() {
+        DetachWeak();
+#ifdef SMART_PTRS_REGISTRY
+        live_.Unlink();
+#endif
+    }
+
+    void IncRef() {
+        SMART_PTRS_TRACE_EVENT(Derived, kIncrement);
+        counter_.IncRef();
+    };
+    // Weak references expire before the object is destroyed, so they can't lock it anymore
+    void DecRef() {
+        SMART_PTRS_TRACE_EVENT(Derived, kDecrement);
+        if (!counter_.DecRef()) {
+            DetachWeak();
+            Deleter::Destroy(static_cast<Derived*>(this));
+        }
+    };
+    size_t RefCount() const {
+        return counter_.RefCount();
+    };
+
+    // Creates the side block on first use.
+    IntrusiveWeakBlock* GetWeakBlock() {
+        if (!weak_block_) {
+            weak_block_ = new IntrusiveWeakBlock;
+        }
+        return weak_block_;
+    };
+
+private:
+    void LinkLive() {
+#ifdef SMART_PTRS_REGISTRY
+        live_.Link(&DescribeLive, this, sizeof(Derived));
+#endif
+    }
+    void DetachWeak() {
+        if (weak_block_) {
+            weak_block_->alive = false;
+            std::exchange(weak_block_, nullptr)->DecWeak();
+        }
+    }
+
+    Counter counter_;
+    IntrusiveWeakBlock* weak_block_ = nullptr;
+#ifdef SMART_PTRS_REGISTRY
+    LiveNode live_;
+
+    // Weak references are those to the side block, less the object's own
+    static void DescribeLive(const void* owner, const std::type_info*& type, size_t& strong,
+                             size_t& weak) {
+        auto object = static_cast<const RefCountedWithWeak*>(owner);
+        type = &typeid(Derived);
+        strong = object->RefCount();
+        weak = object->weak_block_ ? object->weak_block_->weak_count - 1 : 0;
+    }
+#endif
+};
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -67,12 +184,14 @@ public:
     IntrusivePtr() : counted_(nullptr){};
     IntrusivePtr(std::nullptr_t) : counted_(nullptr){};
     IntrusivePtr(T* ptr) {
+        SMART_PTRS_TRACE_EVENT(T, kConstruct);
         counted_ = ptr;
         counted_->IncRef();
     }
 
     template <typename Y>
     IntrusivePtr(const IntrusivePtr<Y>& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         counted_ = other.counted_;
         if (counted_) {
             counted_->IncRef();
@@ -81,23 +200,27 @@ public:
 
     template <typename Y>
     IntrusivePtr(IntrusivePtr<Y>&& other) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         counted_ = other.counted_;
         other.counted_ = nullptr;
     };
 
     IntrusivePtr(const IntrusivePtr& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         counted_ = other.counted_;
         if (counted_) {
             counted_->IncRef();
         }
     };
     IntrusivePtr(IntrusivePtr&& other) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         counted_ = other.counted_;
         other.counted_ = nullptr;
     };
 
     // `operator=`-s
     IntrusivePtr& operator=(const IntrusivePtr& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         if (counted_ != other.counted_) {
             Reset();
             counted_ = other.counted_;
@@ -108,6 +231,7 @@ public:
         return *this;
     };
     IntrusivePtr& operator=(IntrusivePtr&& other) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         if (counted_ != other.counted_) {
             Reset();
             counted_ = other.counted_;
@@ -168,3 +292,83 @@ IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     auto counted = new T(std::forward<Args>(args)...);
     return IntrusivePtr<T>(counted);
 };
+
+// Weak reference to an object derived from `RefCountedWithWeak`
+template <typename T>
+class IntrusiveWeakPtr {
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+    T* ptr_;
+    IntrusiveWeakBlock* block_;
+
+public:
+    // Constructors
+    IntrusiveWeakPtr() : ptr_(nullptr), block_(nullptr){};
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusivePtr<Y>& other) : ptr_(other.Get()), block_(nullptr) {
+        if (ptr_) {
+            block_ = ptr_->GetWeakBlock();
+            ++block_->weak_count;
+        }
+    };
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Y>& other) : ptr_(other.ptr_), block_(other.block_) {
+        if (block_) {
+            ++block_->weak_count;
+        }
+    };
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : ptr_(other.ptr_), block_(other.block_) {
+        if (block_) {
+            ++block_->weak_count;
+        }
+    };
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other)
+        : ptr_(std::exchange(other.ptr_, nullptr)), block_(std::exchange(other.block_, nullptr)){};
+
+    // `operator=`-s
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    };
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    };
+
+    // Destructor
+    ~IntrusiveWeakPtr() {
+        Reset();
+    };
+
+    // Modifiers
+    void Reset() {
+        if (block_) {
+            block_->DecWeak();
+            block_ = nullptr;
+        }
+        ptr_ = nullptr;
+    };
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(block_, other.block_);
+    };
+
+    // Observers
+    size_t UseCount() const {
+        if (Expired()) {
+            return 0;
+        }
+        return ptr_->RefCount();
+    };
+    bool Expired() const {
+        return !block_ || !block_->alive;
+    };
+    IntrusivePtr<T> Lock() const {
+        SMART_PTRS_TRACE_EVENT(T, kLock);
+        if (Expired()) {
+            SMART_PTRS_TRACE_EVENT(T, kLockFailure);
+            return nullptr;
+        }
+        return IntrusivePtr<T>(ptr_);
+    };
+};
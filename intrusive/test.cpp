@@ -386,3 +386,68 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct TreeNode : public RefCountedWithWeak<TreeNode> {
+    IntrusivePtr<TreeNode> child;
+    IntrusiveWeakPtr<TreeNode> parent;
+    std::string name;
+
+    explicit TreeNode(std::string name) : name(std::move(name)) {
+    }
+};
+
+TEST_CASE("Weak references") {
+    SECTION("Sizeof") {
+        REQUIRE(sizeof(RefCountedWithWeak<TreeNode>) == sizeof(SimpleCounter) + sizeof(void*));
+    }
+
+    SECTION("Side block is lazy") {
+        EXPECT_ONE_ALLOCATION(auto node = MakeIntrusive<TreeNode>("root"));
+        auto node = MakeIntrusive<TreeNode>("root");
+        EXPECT_ONE_ALLOCATION(IntrusiveWeakPtr<TreeNode> weak(node));
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        EXPECT_ZERO_ALLOCATIONS(IntrusiveWeakPtr<TreeNode> another(node));
+    }
+
+    SECTION("Lock") {
+        IntrusiveWeakPtr<TreeNode> weak;
+        REQUIRE(weak.Expired());
+        REQUIRE(!weak.Lock());
+        {
+            auto node = MakeIntrusive<TreeNode>("root");
+            weak = node;
+            REQUIRE(!weak.Expired());
+            REQUIRE(weak.UseCount() == 1);
+            auto locked = weak.Lock();
+            REQUIRE(locked.Get() == node.Get());
+            REQUIRE(node.UseCount() == 2);
+        }
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.UseCount() == 0);
+        REQUIRE(!weak.Lock());
+    }
+
+    SECTION("Back-pointers") {
+        IntrusiveWeakPtr<TreeNode> leaf_parent;
+        {
+            auto root = MakeIntrusive<TreeNode>("root");
+            root->child = MakeIntrusive<TreeNode>("leaf");
+            root->child->parent = root;
+            REQUIRE(root->child->parent.Lock()->name == "root");
+            REQUIRE(root.UseCount() == 1);
+            leaf_parent = root->child->parent;
+        }
+        REQUIRE(leaf_parent.Expired());
+    }
+
+    SECTION("Copies are separate objects") {
+        auto node = MakeIntrusive<TreeNode>("root");
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        IntrusivePtr<TreeNode> copy(new TreeNode(*node));
+        node.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(copy->name == "root");
+    }
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// `EnableSharedFromThis` needs weak references, so it is built on top of the weak stage
+#include <weak/shared.h>
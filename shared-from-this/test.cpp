@@ -0,0 +1,122 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <common/my_int.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Node : EnableSharedFromThis<Node> {
+    explicit Node(int value) : value(value) {
+    }
+    int value;
+};
+
+struct Derived : Node {
+    Derived() : Node(7) {
+    }
+};
+
+TEST_CASE("SharedFromThis") {
+    SECTION("From MakeShared") {
+        auto node = MakeShared<Node>(42);
+        auto self = node->SharedFromThis();
+        REQUIRE(self.Get() == node.Get());
+        REQUIRE(node.UseCount() == 2);
+        REQUIRE(self->value == 42);
+    }
+
+    SECTION("From a raw pointer") {
+        SharedPtr<Node> node(new Node(1));
+        auto self = node->SharedFromThis();
+        REQUIRE(self.Get() == node.Get());
+        REQUIRE(node.UseCount() == 2);
+    }
+
+    SECTION("Const") {
+        const auto node = MakeShared<Node>(3);
+        const Node& ref = *node;
+        SharedPtr<const Node> self = ref.SharedFromThis();
+        REQUIRE(self.Get() == node.Get());
+        REQUIRE(node.UseCount() == 2);
+    }
+
+    SECTION("Through a derived class") {
+        SharedPtr<Derived> derived = MakeShared<Derived>();
+        SharedPtr<Node> self = derived->SharedFromThis();
+        REQUIRE(self.Get() == derived.Get());
+        REQUIRE(derived.UseCount() == 2);
+    }
+
+    SECTION("No allocations") {
+        auto node = MakeShared<Node>(42);
+        EXPECT_ZERO_ALLOCATIONS(node->SharedFromThis());
+        EXPECT_ZERO_ALLOCATIONS(node->WeakFromThis());
+    }
+}
+
+TEST_CASE("Not owned") {
+    Node node(1);
+    REQUIRE_THROWS_AS(node.SharedFromThis(), BadWeakPtr);
+    REQUIRE(node.WeakFromThis().Expired());
+
+    auto owned = MakeShared<Node>(2);
+    Node copy(*owned);
+    REQUIRE_THROWS_AS(copy.SharedFromThis(), BadWeakPtr);
+    copy = *owned;
+    REQUIRE_THROWS_AS(copy.SharedFromThis(), BadWeakPtr);
+    REQUIRE(owned.UseCount() == 1);
+}
+
+struct Tracked : EnableSharedFromThis<Tracked> {
+    MyInt value;
+};
+
+TEST_CASE("Lifetime") {
+    SECTION("The object goes away with its last owner") {
+        {
+            auto tracked = MakeShared<Tracked>();
+            auto self = tracked->SharedFromThis();
+            REQUIRE(MyInt::AliveCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Separate block") {
+        {
+            SharedPtr<Tracked> tracked(new Tracked);
+            {
+                auto self = tracked->SharedFromThis();
+            }
+            REQUIRE(MyInt::AliveCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Shared copy outlives the original") {
+        SharedPtr<Tracked> self;
+        {
+            auto tracked = MakeShared<Tracked>();
+            self = tracked->SharedFromThis();
+        }
+        REQUIRE(MyInt::AliveCount() == 1);
+        self.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+}
+
+struct Atomic : EnableSharedFromThis<Atomic, AtomicCounter> {
+    std::string name = "atomic";
+};
+
+TEST_CASE("Other counters") {
+    auto atomic = MakeShared<Atomic, AtomicCounter>();
+    SharedPtr<Atomic, AtomicCounter> self = atomic->SharedFromThis();
+    REQUIRE(self->name == "atomic");
+    REQUIRE(atomic.UseCount() == 2);
+}
@@ -0,0 +1,46 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Widget : EnableSharedFromThis<Widget> {
+};
+
+TEST_CASE("Every way of owning enables SharedFromThis") {
+    SECTION("Constructor") {
+        SharedPtr<Widget> widget(new Widget);
+        REQUIRE(widget->SharedFromThis().Get() == widget.Get());
+    }
+
+    SECTION("Custom deleter") {
+        bool deleted = false;
+        {
+            SharedPtr<Widget> widget(new Widget, [&deleted](Widget* ptr) {
+                deleted = true;
+                delete ptr;
+            });
+            REQUIRE(widget->SharedFromThis().UseCount() == 2);
+        }
+        REQUIRE(deleted);
+    }
+
+    SECTION("Reset") {
+        SharedPtr<Widget> widget;
+        widget.Reset(new Widget);
+        REQUIRE(widget->SharedFromThis().Get() == widget.Get());
+    }
+
+    SECTION("AllocateShared") {
+        auto widget = AllocateShared<Widget>(std::allocator<Widget>());
+        REQUIRE(widget->SharedFromThis().Get() == widget.Get());
+    }
+}
+
+TEST_CASE("Arrays are not enabled") {
+    SharedPtr<Widget[]> widgets(new Widget[2]);
+    REQUIRE_THROWS_AS(widgets[0].SharedFromThis(), BadWeakPtr);
+}
@@ -0,0 +1,35 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Session : EnableSharedFromThis<Session> {
+};
+
+TEST_CASE("WeakFromThis") {
+    auto session = MakeShared<Session>();
+    WeakPtr<Session> weak = session->WeakFromThis();
+    REQUIRE(weak.UseCount() == 1);
+    REQUIRE(weak.Lock().Get() == session.Get());
+
+    const Session& ref = *session;
+    WeakPtr<const Session> const_weak = ref.WeakFromThis();
+    REQUIRE(const_weak.Lock().Get() == session.Get());
+
+    session.Reset();
+    REQUIRE(weak.Expired());
+    REQUIRE(const_weak.Expired());
+    REQUIRE(weak.Lock().Get() == nullptr);
+}
+
+TEST_CASE("Callback outliving its object") {
+    WeakPtr<Session> callback;
+    {
+        auto session = MakeShared<Session>();
+        callback = session->WeakFromThis();
+        REQUIRE_FALSE(callback.Expired());
+    }
+    REQUIRE(callback.Expired());
+}
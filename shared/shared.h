@@ -257,13 +257,3 @@ SharedPtr<T> MakeShared(Args&&... args) {
     return new_shared;
 };
 
-// Look for usage examples in tests
-template <typename T>
-class EnableSharedFromThis {
-public:
-    SharedPtr<T> SharedFromThis();
-    SharedPtr<const T> SharedFromThis() const;
-
-    WeakPtr<T> WeakFromThis() noexcept {};
-    WeakPtr<const T> WeakFromThis() const noexcept {};
-};
\ No newline at end of file
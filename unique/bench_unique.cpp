@@ -0,0 +1,38 @@
+#include "unique.h"
+
+#include <common/bench.h>
+
+#include <memory>
+#include <utility>
+
+// `UniquePtr` next to `std::unique_ptr`.
+
+constexpr size_t kAllocIterations = 5'000'000;
+constexpr size_t kIterations = 50'000'000;
+
+template <typename Ptr, typename Make>
+void BenchUnique(const std::string& name, Make make) {
+    MeasureNs(name + " construct/destroy", kAllocIterations, [&make] {
+        Ptr ptr = make();
+        DoNotOptimize(ptr);
+    });
+
+    Ptr first = make();
+    Ptr second;
+    MeasureNs(name + " move", kIterations, [&first, &second] {
+        second = std::move(first);
+        first = std::move(second);
+        DoNotOptimize(first);
+    });
+
+    MeasureNs(name + " reset", kAllocIterations, [&first, &make] {
+        first = make();
+        DoNotOptimize(first);
+    });
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    BenchUnique<UniquePtr<int>>("UniquePtr", [] { return UniquePtr<int>(new int(42)); });
+    BenchUnique<std::unique_ptr<int>>("std::unique_ptr", [] { return std::make_unique<int>(42); });
+}
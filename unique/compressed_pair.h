@@ -42,6 +42,10 @@ class CompressedPair : private BaseOptimisationItem<F, 1>, private BaseOptimisat
 public:
     CompressedPair() = default;
 
+    template <typename First,
+              typename = std::enable_if_t<!std::is_same_v<std::decay_t<First>, CompressedPair>>>
+    explicit CompressedPair(First&& first) : BaseOptimisationItem<F, 1>(std::forward<First>(first)) {
+    }
     template <typename First, typename Second>
     CompressedPair(First&& first, Second&& second)
         : BaseOptimisationItem<F, 1>(std::forward<First>(first)),
@@ -5,6 +5,7 @@
 #include <common/my_int.h>
 
 #include <catch.hpp>
+#include <cstdint>
 #include <vector>
 #include <tuple>
 
@@ -503,3 +504,113 @@ TEST_CASE("Upcasts") {
         s2 = std::move(s);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Slots of a fixed pool, referred to by 32-bit indices
+struct Pool {
+    static constexpr uint32_t kNull = 0;  // Slot 0 is never handed out
+
+    int values[8] = {};
+    bool used[8] = {true};
+
+    uint32_t Allocate(int value) {
+        for (uint32_t i = 1; i < 8; ++i) {
+            if (!used[i]) {
+                used[i] = true;
+                values[i] = value;
+                return i;
+            }
+        }
+        return kNull;
+    }
+
+    inline static Pool* current = nullptr;
+};
+
+class Handle {
+public:
+    Handle() = default;
+    Handle(std::nullptr_t) {
+    }
+    explicit Handle(uint32_t index) : index_(index) {
+    }
+
+    int& operator*() const {
+        return Pool::current->values[index_];
+    }
+    int* operator->() const {
+        return &**this;
+    }
+    uint32_t Index() const {
+        return index_;
+    }
+
+    friend bool operator==(Handle left, Handle right) {
+        return left.index_ == right.index_;
+    }
+    friend bool operator!=(Handle left, Handle right) {
+        return !(left == right);
+    }
+
+private:
+    uint32_t index_ = Pool::kNull;
+};
+
+struct HandleDeleter {
+    using pointer = Handle;
+
+    void operator()(Handle handle) const {
+        Pool::current->used[handle.Index()] = false;
+    }
+};
+
+TEST_CASE("Fancy pointers") {
+    Pool pool;
+    Pool::current = &pool;
+
+    SECTION("Stored as is") {
+        static_assert(std::is_same_v<UniquePtr<int, HandleDeleter>::Pointer, Handle>);
+        static_assert(std::is_same_v<UniquePtr<int>::Pointer, int*>);
+        static_assert(sizeof(UniquePtr<int, HandleDeleter>) == sizeof(uint32_t));
+    }
+
+    SECTION("Owns the slot") {
+        {
+            UniquePtr<int, HandleDeleter> u(Handle(pool.Allocate(42)));
+            REQUIRE(u);
+            REQUIRE(*u == 42);
+            REQUIRE(pool.used[u.Get().Index()]);
+        }
+        REQUIRE(!pool.used[1]);
+    }
+
+    SECTION("Release, Reset and moves") {
+        UniquePtr<int, HandleDeleter> u;
+        REQUIRE(!u);
+        REQUIRE(u.Get() == nullptr);
+
+        u.Reset(Handle(pool.Allocate(1)));
+        UniquePtr<int, HandleDeleter> other(std::move(u));
+        REQUIRE(!u);
+        REQUIRE(*other == 1);
+
+        u.Reset(Handle(pool.Allocate(2)));
+        u = std::move(other);
+        REQUIRE(*u == 1);
+        REQUIRE(!pool.used[2]);
+
+        Handle released = u.Release();
+        REQUIRE(!u);
+        REQUIRE(pool.used[released.Index()]);
+        HandleDeleter{}(released);
+    }
+
+    SECTION("Arrays") {
+        UniquePtr<int[], HandleDeleter> u(Handle(pool.Allocate(7)));
+        static_assert(sizeof(u) == sizeof(uint32_t));
+        REQUIRE(*u.Get() == 7);
+        u.Reset();
+        REQUIRE(!pool.used[1]);
+    }
+}
@@ -2,7 +2,8 @@
 
 #include "compressed_pair.h"
 
-#include <cstddef>  // std::nullptr_t
+#include <cstddef>      // std::nullptr_t
+#include <type_traits>  // std::void_t
 
 template <typename T>
 struct DefaultDeleter {
@@ -31,18 +32,34 @@ struct DefaultDeleter<T[]> {
         delete[] ptr;
     }
 };
+// What `UniquePtr` stores: `Deleter::pointer` if the deleter names one, e.g. an offset into a pool
+// or a 32-bit handle, and `T*` otherwise. Like a raw pointer it has to compare with and be
+// assignable from `nullptr`, which stands for "owns nothing".
+// https://en.cppreference.com/w/cpp/memory/unique_ptr
+template <typename T, typename Deleter, typename = void>
+struct UniquePointerType {
+    using Type = T*;
+};
+template <typename T, typename Deleter>
+struct UniquePointerType<T, Deleter,
+                         std::void_t<typename std::remove_reference_t<Deleter>::pointer>> {
+    using Type = typename std::remove_reference_t<Deleter>::pointer;
+};
+
 template <typename T, typename My_Deleter = DefaultDeleter<T>>
 class UniquePtr {
 public:
+    using Pointer = typename UniquePointerType<T, My_Deleter>::Type;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
-    explicit UniquePtr(T* ptr = nullptr) : ptr_and_del_(ptr, My_Deleter{}) {
+    explicit UniquePtr(Pointer ptr = nullptr) : ptr_and_del_(ptr, My_Deleter{}) {
     }
     template <typename other_Deleter>
-    UniquePtr(T* ptr, const other_Deleter& deleter) : ptr_and_del_(ptr, deleter) {
+    UniquePtr(Pointer ptr, const other_Deleter& deleter) : ptr_and_del_(ptr, deleter) {
     }
     template <typename other_Deleter>
-    UniquePtr(T* ptr, other_Deleter&& deleter) : ptr_and_del_(ptr, std::move(deleter)) {
+    UniquePtr(Pointer ptr, other_Deleter&& deleter) : ptr_and_del_(ptr, std::move(deleter)) {
     }
 
     explicit UniquePtr(UniquePtr&& other) noexcept
@@ -79,15 +96,15 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
-    T* Release() {
+    Pointer Release() {
         auto ptr = ptr_and_del_.GetFirst();
         ptr_and_del_.GetFirst() = nullptr;
         return ptr;
     }
-    void Reset(T* ptr = nullptr) {
+    void Reset(Pointer ptr = nullptr) {
         auto ptr_to_delete = ptr_and_del_.GetFirst();
         ptr_and_del_.GetFirst() = ptr;
-        if (ptr_to_delete) {
+        if (ptr_to_delete != nullptr) {
             GetDeleter()(ptr_to_delete);
         }
     }
@@ -97,7 +114,7 @@ public:
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
-    T* Get() const {
+    Pointer Get() const {
         return GetData();
     }
     My_Deleter& GetDeleter() {
@@ -107,7 +124,7 @@ public:
         return ptr_and_del_.GetSecond();
     }
     explicit operator bool() const {
-        if (Get()) {
+        if (Get() != nullptr) {
             return true;
         }
         return false;
@@ -119,17 +136,17 @@ public:
     std::add_lvalue_reference_t<T> operator*() const {
         return *(ptr_and_del_.GetFirst());
     }
-    T* operator->() const {
+    Pointer operator->() const {
         return ptr_and_del_.GetFirst();
     }
 
 private:
-    CompressedPair<T*, My_Deleter> ptr_and_del_;
+    CompressedPair<Pointer, My_Deleter> ptr_and_del_;
 
     auto& GetData() {
         return ptr_and_del_.GetFirst();
     }
-    T* GetData() const {
+    Pointer GetData() const {
         return ptr_and_del_.GetFirst();
     }
 };
@@ -139,18 +156,20 @@ private:
 template <typename T, typename My_Deleter>
 class UniquePtr<T[], My_Deleter> {
 public:
+    using Pointer = typename UniquePointerType<T, My_Deleter>::Type;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
-    explicit UniquePtr(T* ptr = nullptr) : ptr_and_del_(ptr, My_Deleter{}) {
+    explicit UniquePtr(Pointer ptr = nullptr) : ptr_and_del_(ptr, My_Deleter{}) {
     }
 
     template <typename other_Deleter>
-    UniquePtr(T* ptr, other_Deleter&& deleter) : ptr_and_del_(ptr, std::move(deleter)) {
+    UniquePtr(Pointer ptr, other_Deleter&& deleter) : ptr_and_del_(ptr, std::move(deleter)) {
     }
 
     template <typename other_Deleter>
-    UniquePtr(T* ptr, const other_Deleter& deleter) : ptr_and_del_(ptr, deleter) {
+    UniquePtr(Pointer ptr, const other_Deleter& deleter) : ptr_and_del_(ptr, deleter) {
     }
 
     explicit UniquePtr(UniquePtr&& other) noexcept
@@ -187,15 +206,15 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
-    T* Release() {
+    Pointer Release() {
         auto ptr = ptr_and_del_.GetFirst();
         ptr_and_del_.GetFirst() = nullptr;
         return ptr;
     }
-    void Reset(T* ptr = nullptr) {
+    void Reset(Pointer ptr = nullptr) {
         auto ptr_to_delete = ptr_and_del_.GetFirst();
         ptr_and_del_.GetFirst() = ptr;
-        if (ptr_to_delete) {
+        if (ptr_to_delete != nullptr) {
             GetDeleter()(ptr_to_delete);
         }
     }
@@ -208,7 +227,7 @@ public:
     T& operator[](size_t index) const {
         return ptr_and_del_.GetFirst()[index];
     }
-    T* Get() const {
+    Pointer Get() const {
         return ptr_and_del_.GetFirst();
     }
     My_Deleter& GetDeleter() {
@@ -218,7 +237,7 @@ public:
         return ptr_and_del_.GetSecond();
     }
     explicit operator bool() const {
-        if (ptr_and_del_.GetFirst()) {
+        if (ptr_and_del_.GetFirst() != nullptr) {
             return true;
         }
         return false;
@@ -230,10 +249,10 @@ public:
     std::add_lvalue_reference_t<T> operator*() const {
         return *(ptr_and_del_.GetFirst());
     }
-    T* operator->() const {
+    Pointer operator->() const {
         return ptr_and_del_.GetFirst();
     }
 
 private:
-    CompressedPair<T*, My_Deleter> ptr_and_del_;
+    CompressedPair<Pointer, My_Deleter> ptr_and_del_;
 };
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+// Lock-free slot holding a `SharedPtr`, built on split reference counting.
+//
+// The slot holds one word: a pointer to an immutable node with the stored `SharedPtr` and a
+// "local" count of readers currently inside `Load`. A reader bumps the local count, copies the
+// value and then gives its reference back: with a CAS on the word while the node is still
+// installed, or through the node's own "internal" count once a writer has swapped the node
+// out. The writer moves the local count it swapped out into the internal one, and whoever
+// brings that to zero frees the node.
+//
+// Nodes are 16-byte aligned and user space addresses take at most 57 bits (5-level paging),
+// so the pointer needs 53 bits and the local count gets the top 11: at most `kMaxReaders`
+// threads are inside `Load` (or the first step of `CompareExchange`) at once, others wait
+// for one to leave. Pointers with tags in the top bits, as under memory tagging, don't fit and
+// make the writer throw `std::bad_alloc`.
+template <typename T, typename Counter = AtomicCounter>
+class AtomicSharedPtr {
+    static_assert(!std::is_same_v<Counter, SingleThreadCounter>,
+                  "AtomicSharedPtr needs a thread-safe counter");
+    static_assert(sizeof(void*) == sizeof(uint64_t), "Pointer and local count share a word");
+
+    static constexpr int kAddressBits = 57;
+    static constexpr int kAlignBits = 4;
+    static constexpr int kPtrBits = kAddressBits - kAlignBits;
+
+public:
+    static constexpr int64_t kMaxReaders = (int64_t{1} << (64 - kPtrBits)) - 1;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() : word_(0) {
+    }
+    AtomicSharedPtr(SharedPtr<T, Counter> desired) : word_(Pack(MakeNode(std::move(desired)))) {
+    }
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicSharedPtr() {
+        Retire(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Operations
+
+    SharedPtr<T, Counter> Load() const {
+        Node* node = AcquireNode();
+        SharedPtr<T, Counter> result;
+        if (node) {
+            result = node->value;
+        }
+        ReleaseNode(node);
+        return result;
+    }
+    void Store(SharedPtr<T, Counter> desired) {
+        Retire(word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel));
+    }
+    SharedPtr<T, Counter> Exchange(SharedPtr<T, Counter> desired) {
+        uint64_t old = word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel);
+        SharedPtr<T, Counter> result;
+        if (Node* node = GetNode(old)) {
+            result = node->value;
+        }
+        Retire(old);
+        return result;
+    }
+    // Replaces the value with `desired` if it holds the same pointer and control block as
+    // `expected`. Otherwise loads the current value into `expected` and returns false.
+    bool CompareExchange(SharedPtr<T, Counter>& expected, SharedPtr<T, Counter> desired) {
+        Node* desired_node = MakeNode(std::move(desired));
+        while (true) {
+            Node* node = AcquireNode();
+            if (!SameAs(node, expected)) {
+                expected = node ? node->value : SharedPtr<T, Counter>();
+                ReleaseNode(node);
+                delete desired_node;
+                return false;
+            }
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            while (GetNode(word) == node) {
+                if (word_.compare_exchange_weak(word, Pack(desired_node), std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    // Our own local reference went away together with the word.
+                    if (node) {
+                        Unref(node, GetLocal(word) - 1);
+                    }
+                    return true;
+                }
+            }
+            ReleaseNode(node);
+        }
+    }
+
+private:
+    struct alignas(1 << kAlignBits) Node {
+        SharedPtr<T, Counter> value;
+        std::atomic<int64_t> internal_count = 0;
+    };
+
+    static constexpr uint64_t kOneLocal = uint64_t{1} << kPtrBits;
+
+    static Node* MakeNode(SharedPtr<T, Counter>&& value) {
+        if (!value.block_ && !value.ptr_) {
+            return nullptr;
+        }
+        Node* node = new Node{std::move(value)};
+        if (reinterpret_cast<uintptr_t>(node) >> kAddressBits) {
+            delete node;
+            throw std::bad_alloc();
+        }
+        return node;
+    }
+    static uint64_t Pack(Node* node) {
+        return reinterpret_cast<uintptr_t>(node) >> kAlignBits;
+    }
+    static Node* GetNode(uint64_t word) {
+        return reinterpret_cast<Node*>((word & (kOneLocal - 1)) << kAlignBits);
+    }
+    static int64_t GetLocal(uint64_t word) {
+        return word >> kPtrBits;
+    }
+    static bool SameAs(Node* node, const SharedPtr<T, Counter>& expected) {
+        if (!node) {
+            return !expected.block_ && !expected.ptr_;
+        }
+        return node->value.block_ == expected.block_ && node->value.ptr_ == expected.ptr_;
+    }
+
+    // Adds `delta` to the internal count and frees the node when it reaches zero.
+    static void Unref(Node* node, int64_t delta) {
+        if (node->internal_count.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+            delete node;
+        }
+    }
+    // Called with a word that is no longer installed: moves its readers to the internal count.
+    static void Retire(uint64_t word) {
+        if (Node* node = GetNode(word)) {
+            Unref(node, GetLocal(word));
+        }
+    }
+
+    // A `fetch_add` would be cheaper, but can't stop the count from wrapping into the pointer
+    Node* AcquireNode() const {
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (true) {
+            if (GetLocal(word) == kMaxReaders) {
+                std::this_thread::yield();
+                word = word_.load(std::memory_order_relaxed);
+            } else if (word_.compare_exchange_weak(word, word + kOneLocal,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed)) {
+                return GetNode(word);
+            }
+        }
+    }
+    void ReleaseNode(Node* node) const {
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        // Local counts on an empty slot are interchangeable, so the `GetLocal` check only guards
+        // against a writer having reset them.
+        while (GetNode(word) == node && GetLocal(word) > 0) {
+            if (word_.compare_exchange_weak(word, word - kOneLocal, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        if (node) {
+            Unref(node, -1);
+        }
+    }
+
+    mutable std::atomic<uint64_t> word_;
+};
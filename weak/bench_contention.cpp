@@ -0,0 +1,145 @@
+#include "shared.h"
+
+#include <intrusive/intrusive.h>
+
+#include <common/bench.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Copy + destroy of pointers from 1 up to all hardware threads, all on one pointer (every
+// thread hits the same counter) or each on its own (no sharing, only the cost of the atomics).
+// Reports throughput and per-op latency percentiles.
+//
+// A clock read costs more than an op, so latency is sampled per batch of `kBatch` ops and
+// divided: the percentiles are of batch averages, a stall shows up diluted by the batch.
+
+constexpr size_t kOpsPerThread = 2'000'000;
+constexpr size_t kBatch = 64;
+
+// `SimpleCounter` is not thread-safe, `IntrusivePtr` gets this one for the benchmark
+class AtomicRefCount {
+public:
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    size_t DecRef() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
+struct Counted : RefCounted<Counted, AtomicRefCount, DefaultDelete> {
+    int value = 42;
+};
+
+struct Result {
+    double ops_per_sec;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double p999_ns;
+};
+
+// Each thread gets `make()` or a copy of one shared `make()`, then copies and drops it
+template <typename Ptr, typename Make>
+Result Run(size_t threads, bool shared, Make make) {
+    Ptr common = make();
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> go = false;
+    std::vector<std::vector<double>> samples(threads);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            // Made by the thread that uses it, as a real owner would
+            Ptr ptr = shared ? common : make();
+            auto& batches = samples[i];
+            batches.reserve(kOpsPerThread / kBatch);
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+            }
+            for (size_t done = 0; done < kOpsPerThread; done += kBatch) {
+                auto start = std::chrono::steady_clock::now();
+                for (size_t j = 0; j < kBatch; ++j) {
+                    Ptr copy(ptr);
+                    DoNotOptimize(copy);
+                }
+                std::chrono::duration<double, std::nano> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                batches.push_back(elapsed.count() / kBatch);
+            }
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> all;
+    for (const auto& batches : samples) {
+        all.insert(all.end(), batches.begin(), batches.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) { return all[static_cast<size_t>(p * (all.size() - 1))]; };
+    return {threads * kOpsPerThread / seconds.count(), percentile(0.5), percentile(0.9),
+            percentile(0.99), percentile(0.999)};
+}
+
+void Print(const std::string& name, const char* mode, size_t threads, const Result& result) {
+    if (OutputFormat() == BenchFormat::kJson) {
+        std::cout << "{\"name\": \"" << name << "\", \"mode\": \"" << mode
+                  << "\", \"threads\": " << threads << ", \"ops_per_sec\": " << result.ops_per_sec
+                  << ", \"p50_ns\": " << result.p50_ns << ", \"p90_ns\": " << result.p90_ns
+                  << ", \"p99_ns\": " << result.p99_ns << ", \"p999_ns\": " << result.p999_ns
+                  << "}" << std::endl;
+    } else {
+        std::cout << name << " " << mode << " x" << threads << ": "
+                  << result.ops_per_sec / 1e6 << " M ops/s, p50 " << result.p50_ns << " ns, p90 "
+                  << result.p90_ns << " ns, p99 " << result.p99_ns << " ns, p99.9 "
+                  << result.p999_ns << " ns" << std::endl;
+    }
+}
+
+template <typename Ptr, typename Make>
+void BenchScaling(const std::string& name, Make make) {
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_threads);
+    for (size_t threads : counts) {
+        Print(name, "shared", threads, Run<Ptr>(threads, true, make));
+        Print(name, "disjoint", threads, Run<Ptr>(threads, false, make));
+    }
+}
+
+template <typename Counter>
+void BenchCounter(const std::string& name) {
+    BenchScaling<SharedPtr<int, Counter>>(name, [] { return MakeShared<int, Counter>(42); });
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    BenchCounter<AtomicCounter>("SharedPtr<AtomicCounter>");
+    BenchCounter<PackedCounter>("SharedPtr<PackedCounter>");
+    BenchCounter<BiasedCounter>("SharedPtr<BiasedCounter>");
+    BenchScaling<IntrusivePtr<Counted>>("IntrusivePtr<AtomicRefCount>",
+                                        [] { return MakeIntrusive<Counted>(); });
+}
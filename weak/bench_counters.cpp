@@ -0,0 +1,31 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <common/bench.h>
+
+// Cost of one copy + destroy of a `SharedPtr` for each counting policy.
+
+constexpr size_t kIterations = 50'000'000;
+
+template <typename Counter>
+void BenchCopyDestroy(const std::string& name) {
+    auto sp = MakeShared<int, Counter>(42);
+    MeasureNs(name + " copy/destroy", kIterations, [&sp] {
+        SharedPtr<int, Counter> copy(sp);
+        DoNotOptimize(copy);
+    });
+
+    WeakPtr<int, Counter> wp(sp);
+    MeasureNs(name + " weak copy/destroy", kIterations, [&wp] {
+        WeakPtr<int, Counter> copy(wp);
+        DoNotOptimize(copy);
+    });
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    BenchCopyDestroy<SingleThreadCounter>("SingleThreadCounter");
+    BenchCopyDestroy<AtomicCounter>("AtomicCounter");
+    BenchCopyDestroy<PackedCounter>("PackedCounter");
+    BenchCopyDestroy<BiasedCounter>("BiasedCounter");
+}
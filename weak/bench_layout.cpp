@@ -0,0 +1,67 @@
+#include "shared.h"
+
+#include <common/bench.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Readers of an object while other threads copy and drop pointers to it, with the counters on
+// the object's cache line and on a line of their own.
+
+constexpr auto kDuration = std::chrono::milliseconds(500);
+
+struct Hot {
+    int fields[4] = {1, 2, 3, 4};
+};
+
+template <BlockLayout Layout>
+void BenchReaders(const std::string& name, size_t readers, size_t writers) {
+    auto sp = MakeShared<Hot, AtomicCounter, Layout>();
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> total_reads = 0;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < readers; ++i) {
+        threads.emplace_back([&] {
+            const Hot* hot = sp.Get();
+            size_t reads = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int j = 0; j < 64; ++j) {
+                    DoNotOptimize(hot->fields[j % 4]);
+                }
+                reads += 64;
+            }
+            total_reads += reads;
+        });
+    }
+    for (size_t i = 0; i < writers; ++i) {
+        threads.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                SharedPtr<Hot, AtomicCounter> copy(sp);
+                DoNotOptimize(copy);
+            }
+        });
+    }
+    std::this_thread::sleep_for(kDuration);
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    // Readers keep counting until they see `stop`, so the time runs until they have all stopped
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    PrintResult(name + " read with " + std::to_string(readers) + " readers " +
+                    std::to_string(writers) + " writers",
+                total_reads, elapsed.count() / total_reads);
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    size_t threads = std::max(2u, std::thread::hardware_concurrency());
+    size_t writers = threads / 2;
+    size_t readers = threads - writers;
+    BenchReaders<BlockLayout::kCompact>("kCompact", readers, writers);
+    BenchReaders<BlockLayout::kPadded>("kPadded", readers, writers);
+}
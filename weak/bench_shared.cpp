@@ -0,0 +1,58 @@
+#include "cycle_collector.h"
+#include "shared.h"
+
+#include <common/bench.h>
+
+#include <memory>
+#include <utility>
+
+// `SharedPtr` with every counter policy, next to `std::shared_ptr`. Everything stays on the
+// main thread, so `BiasedCounter` takes its owner's path.
+
+constexpr size_t kAllocIterations = 5'000'000;
+constexpr size_t kIterations = 50'000'000;
+
+template <typename Ptr, typename FromNew, typename Make>
+void BenchShared(const std::string& name, FromNew from_new, Make make) {
+    MeasureNs(name + " construct/destroy", kAllocIterations, [&from_new] {
+        Ptr ptr = from_new();
+        DoNotOptimize(ptr);
+    });
+    MeasureNs(name + " make/destroy", kAllocIterations, [&make] {
+        Ptr ptr = make();
+        DoNotOptimize(ptr);
+    });
+
+    Ptr sp = make();
+    MeasureNs(name + " copy/destroy", kIterations, [&sp] {
+        Ptr copy(sp);
+        DoNotOptimize(copy);
+    });
+
+    Ptr other;
+    MeasureNs(name + " move", kIterations, [&sp, &other] {
+        other = std::move(sp);
+        sp = std::move(other);
+        DoNotOptimize(sp);
+    });
+}
+
+template <typename Counter>
+void BenchCounter(const std::string& name) {
+    BenchShared<SharedPtr<int, Counter>>(
+        name, [] { return SharedPtr<int, Counter>(new int(42)); },
+        [] { return MakeShared<int, Counter>(42); });
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    StartAThread();
+    BenchCounter<SingleThreadCounter>("SharedPtr<SingleThreadCounter>");
+    BenchCounter<AtomicCounter>("SharedPtr<AtomicCounter>");
+    BenchCounter<PackedCounter>("SharedPtr<PackedCounter>");
+    BenchCounter<BiasedCounter>("SharedPtr<BiasedCounter>");
+    BenchCounter<CycleCounter>("SharedPtr<CycleCounter>");
+    BenchShared<std::shared_ptr<int>>(
+        "std::shared_ptr", [] { return std::shared_ptr<int>(new int(42)); },
+        [] { return std::make_shared<int>(42); });
+}
@@ -0,0 +1,73 @@
+#include "cycle_collector.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <common/bench.h>
+
+#include <memory>
+
+// `WeakPtr` with every counter policy, next to `std::weak_ptr`: making, copying, checking and
+// locking weak pointers, live and dangling.
+
+constexpr size_t kIterations = 50'000'000;
+
+template <typename Counter>
+SharedPtr<int, Counter> Lock(const WeakPtr<int, Counter>& weak) {
+    return weak.Lock();
+}
+std::shared_ptr<int> Lock(const std::weak_ptr<int>& weak) {
+    return weak.lock();
+}
+template <typename Counter>
+bool Expired(const WeakPtr<int, Counter>& weak) {
+    return weak.Expired();
+}
+bool Expired(const std::weak_ptr<int>& weak) {
+    return weak.expired();
+}
+
+template <typename Shared, typename Weak, typename Make>
+void BenchWeak(const std::string& name, Make make) {
+    Shared sp = make();
+    Weak wp(sp);
+    MeasureNs(name + " from shared/destroy", kIterations, [&sp] {
+        Weak weak(sp);
+        DoNotOptimize(weak);
+    });
+    MeasureNs(name + " copy/destroy", kIterations, [&wp] {
+        Weak copy(wp);
+        DoNotOptimize(copy);
+    });
+    MeasureNs(name + " lock", kIterations, [&wp] {
+        Shared locked = Lock(wp);
+        DoNotOptimize(locked);
+    });
+    MeasureNs(name + " expired", kIterations, [&wp] {
+        bool expired = Expired(wp);
+        DoNotOptimize(expired);
+    });
+
+    Weak dangling(make());
+    MeasureNs(name + " lock expired", kIterations, [&dangling] {
+        Shared locked = Lock(dangling);
+        DoNotOptimize(locked);
+    });
+}
+
+template <typename Counter>
+void BenchCounter(const std::string& name) {
+    BenchWeak<SharedPtr<int, Counter>, WeakPtr<int, Counter>>(
+        name, [] { return MakeShared<int, Counter>(42); });
+}
+
+int main(int argc, char** argv) {
+    ParseBenchArgs(argc, argv);
+    StartAThread();
+    BenchCounter<SingleThreadCounter>("WeakPtr<SingleThreadCounter>");
+    BenchCounter<AtomicCounter>("WeakPtr<AtomicCounter>");
+    BenchCounter<PackedCounter>("WeakPtr<PackedCounter>");
+    BenchCounter<BiasedCounter>("WeakPtr<BiasedCounter>");
+    BenchCounter<CycleCounter>("WeakPtr<CycleCounter>");
+    BenchWeak<std::shared_ptr<int>, std::weak_ptr<int>>("std::weak_ptr",
+                                                        [] { return std::make_shared<int>(42); });
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+// Included at the end of sw_fwd.h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Biased reference counting (Choi, Shull, Torrellas, PACT'18).
+//
+// The thread that creates a block owns it and counts its references in `biased_` with plain
+// loads and stores. Every other thread counts in the atomic `shared_` word, which may go
+// negative when references created by the owner are dropped elsewhere. When the owner's count
+// reaches zero the two are merged and from then on everybody uses `shared_`.
+//
+// A reference created by the owner but dropped by another thread can leave `biased_` stuck
+// above zero. The thread that makes `shared_` negative queues the block to its owner, and the
+// owner merges queued blocks the next time it creates or releases a block with this counter,
+// when it exits, or when it calls `BiasedCounter::MergeQueued()`. Records of exited threads are
+// handed to new threads, together with the ownership of their blocks. Until one is, the record
+// is orphaned: nobody can change `biased_` of its blocks, so they are merged right away instead
+// of being queued.
+class BiasedCounter {
+public:
+    BiasedCounter() {
+        ThreadRecord* record = CurrentRecord();
+        owner_.store(record, std::memory_order_relaxed);
+        home_ = record;
+        if (!record) {
+            // Created while the thread is exiting: plain atomic counting
+            shared_.store(kOne | kMerged, std::memory_order_relaxed);
+        } else if (record->queue.load(std::memory_order_relaxed)) {
+            MergeQueued();
+        }
+    }
+
+    size_t GetSharedCnt() const {
+        int64_t count = Count(shared_.load(std::memory_order_relaxed));
+        if (owner_.load(std::memory_order_relaxed)) {
+            count += biased_.load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+    void IncSharedCnt() {
+        if (IsOwner()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+    bool TryIncSharedCnt() {
+        // While nothing is queued the owner's references alone keep the object alive
+        if (IsOwner() && !(shared_.load(std::memory_order_relaxed) & kQueued)) {
+            IncSharedCnt();
+            return true;
+        }
+        // Anybody else adds up both halves. The owner can only bring its half to zero by also
+        // changing `shared_`, which makes the CAS fail.
+        int64_t old = shared_.load(std::memory_order_relaxed);
+        do {
+            int64_t count = Count(old);
+            if (!(old & kMerged)) {
+                count += biased_.load(std::memory_order_relaxed);
+            }
+            if (count <= 0) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(old, old + kOne, std::memory_order_relaxed));
+        return true;
+    }
+    Release DecSharedCnt() {
+        if (!IsOwner()) {
+            return DecShared();
+        }
+        uint32_t left = biased_.load(std::memory_order_relaxed) - 1;
+        biased_.store(left, std::memory_order_relaxed);
+        if (left) {
+            // May finish this very block, nothing touches it afterwards
+            if (current_record->queue.load(std::memory_order_relaxed)) {
+                MergeQueued();
+            }
+            return Release::kAlive;
+        }
+        owner_.store(nullptr, std::memory_order_relaxed);
+        int64_t old = shared_.fetch_or(kMerged, std::memory_order_acq_rel);
+        // A queued block is finished by its owner's queue
+        return Count(old) || (old & kQueued) ? Release::kAlive : Last();
+    }
+    size_t GetWeakCnt() const {
+        return weak_.load(std::memory_order_relaxed) - (GetSharedCnt() ? 1 : 0);
+    }
+    void IncWeakCnt() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+    size_t DecWeakCnt() {
+        return weak_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    // Merges the blocks other threads have queued to the calling thread
+    static void MergeQueued();
+
+private:
+    struct ThreadRecord {
+        std::atomic<BiasedCounter*> queue = nullptr;
+        bool merging = false;
+        bool orphaned = false;  // Guarded by the pool mutex
+    };
+    struct RecordPool {
+        std::mutex mutex;
+        std::vector<ThreadRecord*> free;
+    };
+    // Gives the record back to the pool when its thread exits
+    struct RecordHolder {
+        ~RecordHolder();
+    };
+
+    static constexpr int64_t kMerged = 1;
+    static constexpr int64_t kQueued = 2;
+    static constexpr int64_t kOne = 4;
+
+    static int64_t Count(int64_t word) {
+        return (word & ~(kOne - 1)) / kOne;
+    }
+
+    bool IsOwner() const {
+        return current_record && owner_.load(std::memory_order_relaxed) == current_record;
+    }
+    Release Last() const {
+        return weak_.load(std::memory_order_acquire) == 1 ? Release::kLastReference
+                                                          : Release::kLastShared;
+    }
+    Release DecShared() {
+        int64_t old = shared_.load(std::memory_order_relaxed);
+        int64_t desired;
+        do {
+            desired = old - kOne;
+            if (!(old & (kMerged | kQueued)) && Count(desired) < 0) {
+                desired |= kQueued;
+            }
+        } while (!shared_.compare_exchange_weak(old, desired, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+        if ((desired & kQueued) && !(old & kQueued)) {
+            return Queue();
+        }
+        if ((desired & kMerged) && !(desired & kQueued) && !Count(desired)) {
+            return Last();
+        }
+        return Release::kAlive;
+    }
+    // Checked and pushed under the pool mutex, so an exiting owner either merges the block or
+    // leaves the record orphaned first
+    Release Queue() {
+        std::lock_guard lock(GetPool().mutex);
+        if (home_->orphaned) {
+            return Merge();
+        }
+        BiasedCounter* head = home_->queue.load(std::memory_order_relaxed);
+        do {
+            queue_next_ = head;
+        } while (!home_->queue.compare_exchange_weak(head, this, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        return Release::kAlive;
+    }
+    // Called for a queued block by the owner, or by anyone while the owner's record is orphaned
+    Release Merge() {
+        int64_t biased = 0;
+        if (owner_.load(std::memory_order_relaxed)) {
+            biased = biased_.load(std::memory_order_relaxed);
+            owner_.store(nullptr, std::memory_order_relaxed);
+        }
+        int64_t old = shared_.load(std::memory_order_relaxed);
+        int64_t desired;
+        do {
+            desired = ((old + biased * kOne) | kMerged) & ~kQueued;
+        } while (!shared_.compare_exchange_weak(old, desired, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+        return Count(desired) ? Release::kAlive : Last();
+    }
+
+    // Records are never freed: blocks keep pointing to them after their threads exit.
+    static RecordPool& GetPool() {
+        static RecordPool* pool = new RecordPool;
+        return *pool;
+    }
+    static ThreadRecord* CurrentRecord() {
+        if (!current_record && !exited) {
+            {
+                std::lock_guard lock(GetPool().mutex);
+                if (GetPool().free.empty()) {
+                    current_record = new ThreadRecord;
+                } else {
+                    current_record = GetPool().free.back();
+                    current_record->orphaned = false;
+                    GetPool().free.pop_back();
+                }
+            }
+            static thread_local RecordHolder holder;
+        }
+        return current_record;
+    }
+
+    inline static thread_local ThreadRecord* current_record = nullptr;
+    inline static thread_local bool exited = false;
+
+    std::atomic<ThreadRecord*> owner_;
+    ThreadRecord* home_;
+    std::atomic<uint32_t> biased_ = 1;
+    std::atomic<int64_t> shared_ = 0;
+    std::atomic<size_t> weak_ = 1;
+    BiasedCounter* queue_next_ = nullptr;
+};
+
+inline void BiasedCounter::MergeQueued() {
+    using Block = BaseControlBlock<BiasedCounter>;
+    // The counter is the first member of the block, so one converts to the other
+    static_assert(std::is_standard_layout_v<Block>);
+
+    ThreadRecord* record = CurrentRecord();
+    if (!record || record->merging) {
+        return;
+    }
+    record->merging = true;
+    while (BiasedCounter* counter = record->queue.exchange(nullptr, std::memory_order_acquire)) {
+        while (counter) {
+            BiasedCounter* next = counter->queue_next_;
+            reinterpret_cast<Block*>(counter)->Expire(counter->Merge());
+            counter = next;
+        }
+    }
+    record->merging = false;
+}
+
+inline BiasedCounter::RecordHolder::~RecordHolder() {
+    using Block = BaseControlBlock<BiasedCounter>;
+
+    MergeQueued();
+    // From here on the thread owns nothing, so `biased_` of its blocks is frozen
+    ThreadRecord* record = current_record;
+    current_record = nullptr;
+    exited = true;
+    // Blocks queued after the merge above. They are merged before the record can be taken over
+    // and expired after the mutex is released, since destructors may use this counter too.
+    std::vector<std::pair<BiasedCounter*, Release>> merged;
+    {
+        std::lock_guard lock(GetPool().mutex);
+        record->orphaned = true;
+        BiasedCounter* counter = record->queue.exchange(nullptr, std::memory_order_acquire);
+        for (; counter; counter = counter->queue_next_) {
+            merged.emplace_back(counter, counter->Merge());
+        }
+        GetPool().free.push_back(record);
+    }
+    for (auto [counter, release] : merged) {
+        reinterpret_cast<Block*>(counter)->Expire(release);
+    }
+}
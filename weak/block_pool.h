@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Thread-caching pool for control blocks, used when SMART_PTRS_BLOCK_POOL is defined.
+//
+// Blocks are grouped in 16-byte size classes up to 256 bytes. Each thread keeps a free list per
+// class and serves allocations from it without any synchronization. A thread that frees more
+// blocks than it caches (e.g. a consumer releasing what a producer allocated) hands them over
+// to a shared central list in batches, and threads with an empty list refill from there in
+// batches too. Memory is never given back to the system, only reused.
+class BlockPool {
+public:
+    struct Stats {
+        size_t hits = 0;          // Allocations served from a cache
+        size_t misses = 0;        // Allocations that had to call `::operator new`
+        size_t bytes_cached = 0;  // Bytes sitting in the free lists right now
+    };
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        size_t size_class = GetClass(size);
+        ThreadCache* cache = GetThreadCache();
+        if (!cache) {
+            return AllocateCentral(size_class);
+        }
+        FreeList& list = cache->lists[size_class];
+        if (!list.head) {
+            Refill(cache, size_class);
+        }
+        if (!list.head) {
+            Bump(cache->misses, 1);
+            return ::operator new(ClassSize(size_class));
+        }
+        Bump(cache->hits, 1);
+        Bump(cache->bytes_cached, -ClassSize(size_class));
+        return Pop(list);
+    }
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr);
+            return;
+        }
+        size_t size_class = GetClass(size);
+        ThreadCache* cache = GetThreadCache();
+        if (!cache) {
+            std::lock_guard lock(GetCentral().mutex);
+            Push(GetCentral().lists[size_class], ptr);
+            GetCentral().bytes_cached += ClassSize(size_class);
+            return;
+        }
+        FreeList& list = cache->lists[size_class];
+        Push(list, ptr);
+        Bump(cache->bytes_cached, ClassSize(size_class));
+        if (list.size > kMaxCached) {
+            std::lock_guard lock(GetCentral().mutex);
+            Flush(cache, size_class, kBatch);
+        }
+    }
+
+    static Stats GetStats() {
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        Stats stats = central.retired;
+        stats.bytes_cached += central.bytes_cached;
+        for (ThreadCache* cache : central.caches) {
+            stats.hits += cache->hits.load(std::memory_order_relaxed);
+            stats.misses += cache->misses.load(std::memory_order_relaxed);
+            stats.bytes_cached += cache->bytes_cached.load(std::memory_order_relaxed);
+        }
+        return stats;
+    }
+
+private:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kClasses = 16;
+    static constexpr size_t kMaxSize = kGranularity * kClasses;
+    static constexpr size_t kMaxCached = 64;
+    static constexpr size_t kBatch = 32;
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+    struct FreeList {
+        FreeNode* head = nullptr;
+        size_t size = 0;
+    };
+
+    struct ThreadCache {
+        ThreadCache();
+        ~ThreadCache();
+
+        FreeList lists[kClasses];
+        // Written by the owner thread only, read by `GetStats`
+        std::atomic<size_t> hits = 0;
+        std::atomic<size_t> misses = 0;
+        std::atomic<size_t> bytes_cached = 0;
+    };
+
+    struct Central {
+        std::mutex mutex;
+        FreeList lists[kClasses];
+        size_t bytes_cached = 0;
+        std::vector<ThreadCache*> caches;
+        Stats retired;  // Counters of threads that have already exited
+    };
+
+    static size_t GetClass(size_t size) {
+        return size ? (size - 1) / kGranularity : 0;
+    }
+    static size_t ClassSize(size_t size_class) {
+        return (size_class + 1) * kGranularity;
+    }
+    static void Bump(std::atomic<size_t>& counter, size_t delta) {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+    static void Push(FreeList& list, void* ptr) {
+        auto node = static_cast<FreeNode*>(ptr);
+        node->next = list.head;
+        list.head = node;
+        ++list.size;
+    }
+    static void* Pop(FreeList& list) {
+        FreeNode* node = list.head;
+        list.head = node->next;
+        --list.size;
+        return node;
+    }
+    static void Refill(ThreadCache* cache, size_t size_class) {
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        FreeList& from = central.lists[size_class];
+        size_t moved = 0;
+        for (; moved < kBatch && from.head; ++moved) {
+            Push(cache->lists[size_class], Pop(from));
+        }
+        central.bytes_cached -= moved * ClassSize(size_class);
+        Bump(cache->bytes_cached, moved * ClassSize(size_class));
+    }
+    // Gives up to `count` blocks back to the central list, with its mutex held.
+    static void Flush(ThreadCache* cache, size_t size_class, size_t count) {
+        FreeList& from = cache->lists[size_class];
+        size_t moved = 0;
+        for (; moved < count && from.head; ++moved) {
+            Push(GetCentral().lists[size_class], Pop(from));
+        }
+        GetCentral().bytes_cached += moved * ClassSize(size_class);
+        Bump(cache->bytes_cached, -moved * ClassSize(size_class));
+    }
+    // Used once the calling thread's cache is gone, i.e. from thread-exit destructors.
+    static void* AllocateCentral(size_t size_class) {
+        Central& central = GetCentral();
+        std::lock_guard lock(central.mutex);
+        FreeList& list = central.lists[size_class];
+        if (!list.head) {
+            ++central.retired.misses;
+            return ::operator new(ClassSize(size_class));
+        }
+        ++central.retired.hits;
+        central.bytes_cached -= ClassSize(size_class);
+        return Pop(list);
+    }
+
+    // Never destroyed: blocks may be freed by destructors of other statics.
+    static Central& GetCentral() {
+        static Central* central = new Central;
+        return *central;
+    }
+    static ThreadCache* GetThreadCache() {
+        static thread_local ThreadCache cache;
+        return cache_alive ? &cache : nullptr;
+    }
+
+    // Trivially destructible, so frees that happen on an exiting thread after its cache is gone
+    // can still see that.
+    inline static thread_local bool cache_alive = false;
+};
+
+inline BlockPool::ThreadCache::ThreadCache() {
+    std::lock_guard lock(GetCentral().mutex);
+    GetCentral().caches.push_back(this);
+    cache_alive = true;
+}
+
+inline BlockPool::ThreadCache::~ThreadCache() {
+    Central& central = GetCentral();
+    std::lock_guard lock(central.mutex);
+    cache_alive = false;
+    for (size_t size_class = 0; size_class < kClasses; ++size_class) {
+        Flush(this, size_class, lists[size_class].size);
+    }
+    central.retired.hits += hits;
+    central.retired.misses += misses;
+    central.caches.erase(std::find(central.caches.begin(), central.caches.end(), this));
+}
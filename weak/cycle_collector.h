@@ -0,0 +1,496 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <type_traits>
+#include <vector>
+
+// Opt-in collection of reference cycles among `SharedPtr<T, CycleCounter>` objects, by trial
+// deletion (Bacon, Rajan, "Concurrent Cycle Collection in Reference Counted Systems", the
+// synchronous variant).
+//
+// A block whose strong count drops without reaching zero may be the last way into a garbage
+// cycle, so it is buffered as a candidate. The collector subtracts the references that
+// candidates' subgraphs hold to themselves; whatever ends up at zero is only referenced from
+// inside and is freed. Objects list their outgoing edges through `CycleEdges`, types without
+// edges are never candidates.
+//
+// The subtraction goes to a scratch count, not the real one, so a trace can be cut short and
+// resumed by a later `Collect`. Meanwhile the program may use the objects: any reference gained,
+// lost or moved to a block the trace has reached sends it back to the start. Moving a container
+// of pointers moves them all without touching any, so before anything is freed the garbage
+// found is checked in one go to be referenced only from itself, and the trace starts over if
+// not. Once garbage is confirmed nothing can reach it any more, so freeing it may span calls
+// too.
+//
+// Everything is single-threaded: objects, pointers to them and the collector must stay on one
+// thread, as with `SingleThreadCounter`.
+
+// Types specialize this to list their `SharedPtr<U, CycleCounter>` members:
+//     template <>
+//     struct CycleEdges<Node> {
+//         template <typename Visitor>
+//         static void ForEach(Node& node, Visitor&& visit) {
+//             visit(node.next);
+//             for (auto& child : node.children) {
+//                 visit(child);
+//             }
+//         }
+//     };
+struct NoCycleEdges {};
+template <typename T>
+struct CycleEdges : NoCycleEdges {
+    template <typename Visitor>
+    static void ForEach(T&, Visitor&&) {
+    }
+};
+
+class CycleCounter {
+public:
+    // Garbage waiting to be freed reads as expired
+    size_t GetSharedCnt() const {
+        return Condemned() ? 0 : shared_;
+    }
+    void IncSharedCnt() {
+        ++shared_;
+        purple_ = false;
+        Changed();
+    }
+    bool TryIncSharedCnt() {
+        if (!shared_ || Condemned()) {
+            return false;
+        }
+        IncSharedCnt();
+        return true;
+    }
+    Release DecSharedCnt() {
+        Changed();
+        if (--shared_) {
+            PossibleRoot();
+            return Release::kAlive;
+        }
+        return weak_ == 1 ? Release::kLastReference : Release::kLastShared;
+    }
+    // The collector's own reference to a candidate is not reported
+    size_t GetWeakCnt() const {
+        return weak_ - (shared_ ? 1 : 0) - (buffered_ ? 1 : 0);
+    }
+    void IncWeakCnt() {
+        ++weak_;
+    }
+    size_t DecWeakCnt() {
+        return --weak_;
+    }
+
+    // Called once the block owns `object`
+    template <typename T>
+    void Track(T* object) {
+        using Type = std::remove_cv_t<T>;
+        if constexpr (!std::is_base_of_v<NoCycleEdges, CycleEdges<Type>>) {
+            object_ = const_cast<Type*>(object);
+            traverse_ = &Traverse<Type>;
+        }
+    }
+    // Called when a reference to the block moves between pointers, which may add or remove an
+    // edge without changing a count
+    void OnMove() {
+        Changed();
+    }
+
+private:
+    friend class CycleCollector;
+    using Block = BaseControlBlock<CycleCounter>;
+    using VisitFn = void (*)(Block* child, void* context);
+    // Calls `visit` for every non-empty edge, or resets every edge if `visit` is null
+    using TraverseFn = void (*)(void* object, VisitFn visit, void* context);
+
+    // Meaningful while `trace_` is the collector's current trace
+    enum class Color : uint8_t {
+        kGray,     // Possible member of a garbage cycle
+        kWhite,    // Only referenced from inside the subgraph
+        kBlack,    // Reachable from outside
+        kGarbage,  // Listed for freeing
+    };
+
+    template <typename T>
+    static void Traverse(void* object, VisitFn visit, void* context) {
+        CycleEdges<T>::ForEach(*static_cast<T*>(object), [visit, context](auto& edge) {
+            static_assert(std::is_same_v<decltype(edge.block_), Block*>,
+                          "Edges are `SharedPtr`s with `CycleCounter`");
+            if (!visit) {
+                edge.Reset();
+            } else if (edge.block_) {
+                visit(edge.block_, context);
+            }
+        });
+    }
+
+    // A trace spans several `Collect` calls, the program runs in between: any change to a block
+    // it has already looked at makes it start over
+    void Changed() {
+        if (trace_ == tracing_) {
+            dirty_ = true;
+        }
+    }
+    bool Condemned() const {
+        return trace_ == condemned_ && color_ == Color::kGarbage;
+    }
+    void PossibleRoot();
+
+    inline static size_t tracing_ = 0;    // Trace under way, if any
+    inline static size_t condemned_ = 0;  // Trace whose garbage is being freed, if any
+    inline static bool dirty_ = false;
+
+    size_t shared_ = 1;
+    size_t weak_ = 1;
+    size_t trace_ = 0;    // Last trace that reached the block
+    size_t scratch_ = 0;  // Strong count less the references from inside the traced subgraph
+    Color color_ = Color::kBlack;
+    bool purple_ = false;  // Candidate root
+    bool buffered_ = false;
+    void* object_ = nullptr;
+    TraverseFn traverse_ = nullptr;
+};
+
+class CycleCollector {
+public:
+    static constexpr size_t kStepsPerCheck = 64;
+    static constexpr size_t kMaxRestarts = 4;
+
+    // Runs trial deletion on candidates until they run out or `budget` is spent, and returns the
+    // number of objects freed. Work is done a node at a time with the clock read every
+    // `kStepsPerCheck` nodes, and whatever is left is picked up by the next call, so a call goes
+    // over `budget` by at most that many nodes. A trace the program got in the way of between
+    // calls is started over; a batch restarted more than `kMaxRestarts` times is finished in one
+    // call, whatever the budget, so a busy program can't put it off forever.
+    static size_t Collect(std::chrono::nanoseconds budget) {
+        State& state = GetState();
+        if (state.collecting) {
+            return 0;
+        }
+        state.collecting = true;
+        if (Tracing() && CycleCounter::dirty_) {
+            ++state.restarts;
+            StartTrace();
+        }
+        bool unbounded = state.restarts > kMaxRestarts;
+        auto start = std::chrono::steady_clock::now();
+        size_t freed = 0;
+        for (size_t steps = 1; Step(freed); ++steps) {
+            if (steps % kStepsPerCheck == 0 && !unbounded &&
+                std::chrono::steady_clock::now() - start >= budget) {
+                break;
+            }
+        }
+        state.collecting = false;
+        return freed;
+    }
+    static size_t CollectAll() {
+        return Collect(std::chrono::nanoseconds::max());
+    }
+    // Blocks waiting to be looked at or being looked at
+    static size_t CandidateCount() {
+        return GetState().roots.size() + GetState().batch.size();
+    }
+
+private:
+    friend class CycleCounter;
+    using Block = BaseControlBlock<CycleCounter>;
+    using Color = CycleCounter::Color;
+
+    static constexpr size_t kBatchSize = 64;
+
+    enum class Phase {
+        kGather,        // Taking candidates off the queue
+        kMarkGray,      // Subtracting the references from inside the subgraph
+        kScan,          // Keeping whatever outside references reach
+        kCollectWhite,  // Listing the rest as garbage
+        kHold,          // Taking a reference of our own on each piece of garbage
+        kUnlink,        // Resetting their edges
+        kDrop,          // Dropping our references, which frees them
+    };
+
+    // Lists that grow with the subgraph are deques: growing a vector would copy all of it in one
+    // step
+    struct State {
+        std::deque<Block*> roots;
+        Phase phase = Phase::kGather;
+        std::vector<Block*> batch;  // Roots being traced, kept allocated by their weak references
+        std::deque<Block*> stack;
+        std::deque<Block*> black;  // Work of `Scan` marking a subgraph black, done first
+        std::deque<Block*> garbage;
+        size_t next = 0;  // Next entry of `batch` or `garbage` for the phase
+        size_t trace = 0;
+        size_t restarts = 0;
+        bool collecting = false;
+    };
+    static State& GetState() {
+        static State state;
+        return state;
+    }
+
+    static CycleCounter& Counter(Block* block) {
+        return block->counter;
+    }
+    static bool Traced(Block* block) {
+        return Counter(block).trace_ == GetState().trace;
+    }
+    static bool Tracing() {
+        Phase phase = GetState().phase;
+        return phase == Phase::kMarkGray || phase == Phase::kScan || phase == Phase::kCollectWhite;
+    }
+    template <typename F>
+    static void ForEachChild(Block* block, F& visit) {
+        CycleCounter& counter = Counter(block);
+        if (counter.traverse_) {
+            counter.traverse_(
+                counter.object_,
+                [](Block* child, void* context) { (*static_cast<F*>(context))(child); }, &visit);
+        }
+    }
+    static void Advance(Phase phase) {
+        GetState().phase = phase;
+        GetState().next = 0;
+    }
+    static Block* Pop(std::deque<Block*>& stack) {
+        Block* block = stack.back();
+        stack.pop_back();
+        return block;
+    }
+
+    // Does one node's worth of work, returns false once there is nothing left
+    static bool Step(size_t& freed) {
+        switch (GetState().phase) {
+            case Phase::kGather:
+                return Gather();
+            case Phase::kMarkGray:
+                MarkGray();
+                break;
+            case Phase::kScan:
+                Scan();
+                break;
+            case Phase::kCollectWhite:
+                CollectWhite();
+                break;
+            case Phase::kHold:
+            case Phase::kUnlink:
+            case Phase::kDrop:
+                Free(freed);
+                break;
+        }
+        return true;
+    }
+
+    static bool Gather() {
+        State& state = GetState();
+        if (state.roots.empty() || state.batch.size() == kBatchSize) {
+            if (state.batch.empty()) {
+                return false;
+            }
+            StartTrace();
+            return true;
+        }
+        Block* root = state.roots.front();
+        state.roots.pop_front();
+        if (Counter(root).purple_ && Counter(root).shared_) {
+            // Turns purple again if it loses a reference while the batch is looked at
+            Counter(root).purple_ = false;
+            state.batch.push_back(root);
+        } else {
+            Unbuffer(root);
+        }
+        return true;
+    }
+    static void StartTrace() {
+        State& state = GetState();
+        Advance(Phase::kMarkGray);
+        state.stack.clear();
+        state.black.clear();
+        state.garbage.clear();
+        CycleCounter::tracing_ = ++state.trace;
+        CycleCounter::dirty_ = false;
+    }
+
+    // Subtracts the references coming from the subgraph
+    static void MarkGray() {
+        State& state = GetState();
+        auto& stack = state.stack;
+        auto gray = [&stack](Block* block) {
+            CycleCounter& counter = Counter(block);
+            counter.trace_ = GetState().trace;
+            counter.color_ = Color::kGray;
+            counter.scratch_ = counter.shared_;
+            stack.push_back(block);
+        };
+        if (stack.empty()) {
+            if (state.next == state.batch.size()) {
+                Advance(Phase::kScan);
+            } else if (Block* root = state.batch[state.next++];
+                       Counter(root).shared_ && !Traced(root)) {
+                gray(root);
+            }
+            return;
+        }
+        auto visit = [&gray](Block* child) {
+            if (!Traced(child)) {
+                gray(child);
+            }
+            --Counter(child).scratch_;
+        };
+        ForEachChild(Pop(stack), visit);
+    }
+    // Blocks still referenced from outside keep everything they reach, the rest is garbage.
+    // Edges added since `MarkGray` to blocks it never reached are not followed.
+    static void Scan() {
+        State& state = GetState();
+        auto& stack = state.stack;
+        auto& black = state.black;
+        if (!black.empty()) {
+            auto visit = [&black](Block* child) {
+                if (Traced(child) && Counter(child).color_ != Color::kBlack) {
+                    Counter(child).color_ = Color::kBlack;
+                    black.push_back(child);
+                }
+            };
+            ForEachChild(Pop(black), visit);
+            return;
+        }
+        if (stack.empty()) {
+            if (state.next == state.batch.size()) {
+                Advance(Phase::kCollectWhite);
+            } else {
+                stack.push_back(state.batch[state.next++]);
+            }
+            return;
+        }
+        Block* block = Pop(stack);
+        if (!Traced(block) || Counter(block).color_ != Color::kGray) {
+            return;
+        }
+        if (Counter(block).scratch_) {
+            Counter(block).color_ = Color::kBlack;
+            black.push_back(block);
+        } else {
+            Counter(block).color_ = Color::kWhite;
+            auto visit = [&stack](Block* child) { stack.push_back(child); };
+            ForEachChild(block, visit);
+        }
+    }
+    static void CollectWhite() {
+        State& state = GetState();
+        auto& stack = state.stack;
+        if (stack.empty()) {
+            if (state.next < state.batch.size()) {
+                stack.push_back(state.batch[state.next++]);
+                return;
+            }
+            if (!Closed(state.garbage)) {
+                ++state.restarts;
+                StartTrace();
+                return;
+            }
+            // Nothing outside can get at the garbage from here on, not even through weak
+            // references, so freeing it may span calls too
+            CycleCounter::tracing_ = 0;
+            CycleCounter::condemned_ = state.trace;
+            Advance(Phase::kHold);
+            return;
+        }
+        Block* block = Pop(stack);
+        if (Traced(block) && Counter(block).color_ == Color::kWhite) {
+            Counter(block).color_ = Color::kGarbage;
+            state.garbage.push_back(block);
+            auto visit = [&stack](Block* child) { stack.push_back(child); };
+            ForEachChild(block, visit);
+        }
+    }
+    // Checks in one go that every reference to the garbage comes from the garbage itself. The
+    // trace ran over several calls and may have missed edges moved without their pointers
+    // being touched, e.g. a whole container of them.
+    static bool Closed(const std::deque<Block*>& garbage) {
+        for (Block* block : garbage) {
+            Counter(block).scratch_ = Counter(block).shared_;
+        }
+        auto visit = [](Block* child) {
+            if (Traced(child) && Counter(child).color_ == Color::kGarbage) {
+                --Counter(child).scratch_;
+            }
+        };
+        for (Block* block : garbage) {
+            ForEachChild(block, visit);
+        }
+        for (Block* block : garbage) {
+            if (Counter(block).scratch_) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // Objects are destroyed the usual way: with one reference of our own on each, their edges are
+    // reset, then our references are dropped.
+    static void Free(size_t& freed) {
+        State& state = GetState();
+        if (state.next == state.garbage.size()) {
+            if (state.phase == Phase::kHold) {
+                Advance(Phase::kUnlink);
+            } else if (state.phase == Phase::kUnlink) {
+                Advance(Phase::kDrop);
+            } else {
+                FinishBatch();
+            }
+            return;
+        }
+        Block* block = state.garbage[state.next++];
+        if (state.phase == Phase::kHold) {
+            ++Counter(block).shared_;
+        } else if (state.phase == Phase::kUnlink) {
+            if (Counter(block).traverse_) {
+                Counter(block).traverse_(Counter(block).object_, nullptr, nullptr);
+            }
+        } else {
+            block->DecSharedCnt();
+            ++freed;
+        }
+    }
+    static void FinishBatch() {
+        State& state = GetState();
+        CycleCounter::condemned_ = 0;
+        for (Block* root : state.batch) {
+            // Lost a reference again while the batch was looked at
+            if (Counter(root).purple_) {
+                state.roots.push_back(root);
+            } else {
+                Unbuffer(root);
+            }
+        }
+        state.batch.clear();
+        state.garbage.clear();
+        state.restarts = 0;
+        Advance(Phase::kGather);
+    }
+    static void Unbuffer(Block* block) {
+        Counter(block).buffered_ = false;
+        Counter(block).purple_ = false;
+        block->DecWeakCnt();
+    }
+};
+
+// A buffered block is kept allocated by a weak reference, so the collector can tell later that
+// its object is gone.
+inline void CycleCounter::PossibleRoot() {
+    if (!traverse_ || purple_ || Condemned()) {
+        return;
+    }
+    purple_ = true;
+    if (!buffered_) {
+        static_assert(std::is_standard_layout_v<Block>);
+        buffered_ = true;
+        ++weak_;
+        CycleCollector::GetState().roots.push_back(reinterpret_cast<Block*>(this));
+    }
+}
@@ -1,85 +1,148 @@
 #pragma once
 
 #include "sw_fwd.h"  // Forward declaration
+#include "weak.h"    // Embedded in `EnableSharedFromThis`
 
-#include <cstddef>  // std::nullptr_t
+#include <common/ref_trace.h>
+
+#include <cstddef>     // std::nullptr_t
+#include <functional>  // std::hash, std::less
+
+// Points the `EnableSharedFromThis` base of a newly owned object to its control block, so that
+// `SharedFromThis` needs neither an allocation nor a lookup. Does nothing for other types.
+template <typename Counter, typename X, typename Y>
+void SetWeakThis(BaseControlBlock<Counter>* block, const EnableSharedFromThis<X, Counter>* base,
+                 Y* ptr);
+template <typename Counter>
+void SetWeakThis(BaseControlBlock<Counter>*, ...) {
+}
+
+// Tells the block about the object it has just taken over: fills the `EnableSharedFromThis`
+// base, and lets the cycle collector see the object's edges.
+template <typename Counter, typename Y>
+void AdoptObject(BaseControlBlock<Counter>* block, Y* ptr) {
+    SetWeakThis(block, ptr, ptr);
+    if constexpr (std::is_same_v<Counter, CycleCounter>) {
+        block->counter.Track(ptr);
+    }
+}
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-template <typename T>
+template <typename T, typename Counter>
 class SharedPtr {
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
     SharedPtr() : block_(nullptr), ptr_(nullptr) {
     }
     SharedPtr(std::nullptr_t) : block_(nullptr), ptr_(nullptr){};
-    explicit SharedPtr(T* ptr) : block_(nullptr), ptr_(ptr) {
-        block_ = new ControlBlockPtr<T>(ptr);
+    explicit SharedPtr(ElementType* ptr) : block_(nullptr), ptr_(ptr) {
+        block_ = MakeBlock(ptr);
+        Adopt(ptr);
     };
     template <typename Y>
     SharedPtr(Y* ptr) {
         ptr_ = ptr;
-        block_ = new ControlBlockPtr<Y>(ptr);
+        block_ = MakeBlock(ptr);
+        Adopt(ptr);
+    }
+    template <typename Y, typename Deleter>
+    SharedPtr(Y* ptr, Deleter deleter) : block_(MakeBlock(ptr, std::move(deleter))), ptr_(ptr) {
+        Adopt(ptr);
     }
 
     SharedPtr(const SharedPtr& other) : block_(other.block_), ptr_(other.ptr_) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         if (block_) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
             block_->IncSharedCnt();
         }
     };
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other) {
+    SharedPtr(const SharedPtr<Y, Counter>& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         ptr_ = other.ptr_;
         block_ = other.block_;
         if (block_) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
             block_->IncSharedCnt();
         }
     }
     template <typename Y>
-    SharedPtr(SharedPtr<Y>&& other) {
+    SharedPtr(SharedPtr<Y, Counter>&& other) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         ptr_ = other.ptr_;
         block_ = other.block_;
         other.block_ = nullptr;
         other.ptr_ = nullptr;
+        Moved();
     }
 
     SharedPtr(SharedPtr&& other) : block_(other.block_), ptr_(other.ptr_) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         other.block_ = nullptr;
         other.ptr_ = nullptr;
+        Moved();
     };
 
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(const SharedPtr<Y, Counter>& other, ElementType* ptr) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         ptr_ = ptr;
         block_ = other.block_;
         if (block_) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
             block_->IncSharedCnt();
         }
     }
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+    // Checking and incrementing is one step, so a dying object is never brought back
+    explicit SharedPtr(const WeakPtr<T, Counter>& other) {
+        SMART_PTRS_TRACE_EVENT(T, kLock);
+        if (!other.block_ || !other.block_->TryIncSharedCnt()) {
+            SMART_PTRS_TRACE_EVENT(T, kLockFailure);
             throw BadWeakPtr();
         }
+        SMART_PTRS_TRACE_EVENT(T, kIncrement);
         block_ = other.block_;
         ptr_ = other.ptr_;
-        block_->IncSharedCnt();
+    }
+
+    // Adopt a `UniquePtr` together with its deleter
+    // #13 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    // `other` keeps the object if the block cannot be allocated.
+    template <typename Y, typename Deleter>
+    SharedPtr(UniquePtr<Y, Deleter>&& other) : block_(nullptr), ptr_(other.Get()) {
+        static_assert(std::is_pointer_v<typename UniquePtr<Y, Deleter>::Pointer>,
+                      "Only `UniquePtr`s holding raw pointers can be shared");
+        if (!ptr_) {
+            return;
+        }
+        using Element = std::remove_pointer_t<decltype(other.Get())>;
+        block_ = new ControlBlockPtr<Element, Counter, Deleter>(other.Get(),
+                                                               std::move(other.GetDeleter()));
+        Adopt(other.Get());
+        other.Release();
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
     SharedPtr& operator=(const SharedPtr& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         if (other.block_ != nullptr) {
             if (block_ != other.block_) {
                 Reset();
                 ptr_ = other.ptr_;
                 block_ = other.block_;
+                SMART_PTRS_TRACE_EVENT(T, kIncrement);
                 block_->IncSharedCnt();
             }
         } else {
@@ -88,12 +151,14 @@ public:
         return *this;
     };
     template <typename Y>
-    SharedPtr& operator=(const SharedPtr<Y>& other) {
+    SharedPtr& operator=(const SharedPtr<Y, Counter>& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         if (other.block_ != nullptr) {
             if (block_ != other.block_) {
                 Reset();
                 ptr_ = other.ptr_;
                 block_ = other.block_;
+                SMART_PTRS_TRACE_EVENT(T, kIncrement);
                 block_->IncSharedCnt();
             }
         } else {
@@ -102,17 +167,19 @@ public:
         return *this;
     }
     SharedPtr& operator=(SharedPtr&& other) {
-        std::swap(ptr_, other.ptr_);
-        std::swap(block_, other.block_);
+        SMART_PTRS_TRACE_EVENT(T, kMove);
+        Swap(other);
         return *this;
     };
     template <typename Y>
-    SharedPtr& operator=(SharedPtr<Y>&& other) {
+    SharedPtr& operator=(SharedPtr<Y, Counter>&& other) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         if (other.block_ != nullptr) {
             if (block_ != other.block_) {
                 Reset();
                 ptr_ = other.ptr_;
                 block_ = other.block_;
+                SMART_PTRS_TRACE_EVENT(T, kIncrement);
                 block_->IncSharedCnt();
                 other.Reset();
             }
@@ -122,6 +189,12 @@ public:
         return *this;
     }
 
+    template <typename Y, typename Deleter>
+    SharedPtr& operator=(UniquePtr<Y, Deleter>&& other) {
+        SharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Destructor
 
@@ -134,43 +207,66 @@ public:
 
     void Reset() {
         if (block_ != nullptr) {
+            SMART_PTRS_TRACE_EVENT(T, kDecrement);
             block_->DecSharedCnt();
         }
         ptr_ = nullptr;
         block_ = nullptr;
     };
-    void Reset(T* ptr) {
+    void Reset(ElementType* ptr) {
+        auto new_block = MakeBlock(ptr);
         if (block_ != nullptr) {
+            SMART_PTRS_TRACE_EVENT(T, kDecrement);
             block_->DecSharedCnt();
         }
         ptr_ = ptr;
-        block_ = new ControlBlockPtr<T>(ptr);
+        block_ = new_block;
+        Adopt(ptr);
     };
     template <typename Y>
     void Reset(Y* ptr) {
+        auto new_block = MakeBlock(ptr);
         if (block_ != nullptr) {
+            SMART_PTRS_TRACE_EVENT(T, kDecrement);
             block_->DecSharedCnt();
         }
         ptr_ = ptr;
-        block_ = new ControlBlockPtr<Y>(ptr);
+        block_ = new_block;
+        Adopt(ptr);
+    };
+    template <typename Y, typename Deleter>
+    void Reset(Y* ptr, Deleter deleter) {
+        auto new_block = MakeBlock(ptr, std::move(deleter));
+        if (block_ != nullptr) {
+            SMART_PTRS_TRACE_EVENT(T, kDecrement);
+            block_->DecSharedCnt();
+        }
+        ptr_ = ptr;
+        block_ = new_block;
+        Adopt(ptr);
     };
     void Swap(SharedPtr& other) {
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
+        Moved();
+        other.Moved();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     };
-    T& operator*() const {
+    ElementType& operator*() const {
         return *ptr_;
     };
-    T* operator->() const {
+    ElementType* operator->() const {
         return ptr_;
     };
+    ElementType& operator[](size_t index) const {
+        return ptr_[index];
+    };
     size_t UseCount() const {
         if (block_) {
             return block_->GetSharedCnt();
@@ -184,21 +280,227 @@ public:
         return false;
     };
 
-    BaseControlBlock* block_;
-    T* ptr_;
+    BaseControlBlock<Counter>* block_;
+    ElementType* ptr_;
+
+private:
+    // The cycle collector sees moves: they change the object graph without changing a count
+    void Moved() {
+        if constexpr (std::is_same_v<Counter, CycleCounter>) {
+            if (block_) {
+                block_->counter.OnMove();
+            }
+        }
+    }
+    template <typename Y>
+    void Adopt(Y* ptr) {
+        SMART_PTRS_TRACE_EVENT(T, kConstruct);
+        // Elements of an array are never shared from themselves
+        if constexpr (!std::is_array_v<T>) {
+            AdoptObject(block_, ptr);
+        }
+    }
+    // Arrays are owned through `new[]` and go away with `delete[]`
+    template <typename Y>
+    static BaseControlBlock<Counter>* MakeBlock(Y* ptr) {
+        return MakeBlock(ptr, DefaultDeleter<std::conditional_t<std::is_array_v<T>, Y[], Y>>{});
+    }
+    // `ptr` is released with `deleter` even when the block cannot be allocated
+    template <typename Y, typename Deleter>
+    static BaseControlBlock<Counter>* MakeBlock(Y* ptr, Deleter&& deleter) {
+        try {
+            return new ControlBlockPtr<Y, Counter, std::decay_t<Deleter>>(ptr, std::move(deleter));
+        } catch (...) {
+            ReleaseAfterFailure(ptr, deleter);
+            throw;
+        }
+    }
+    // Kept out of line so the optimizer does not fold the release into the caller's cleanup of a
+    // half-built `new T[n]`, which GCC 12 (checked with 12.2) at -O2 then reports as a use after
+    // `delete[]` at every `SharedPtr<T[]>(new T[n])`. Drop `noinline` with GCC 12 support.
+    template <typename Y, typename Deleter>
+    [[gnu::noinline]] static void ReleaseAfterFailure(Y* ptr, Deleter& deleter) {
+        deleter(ptr);
+    }
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
-    return left.ptr == right.ptr_;
+template <typename T, typename U, typename Counter>
+inline bool operator==(const SharedPtr<T, Counter>& left, const SharedPtr<U, Counter>& right) {
+    return left.ptr_ == right.ptr_;
+}
+template <typename T, typename U, typename Counter>
+inline bool operator!=(const SharedPtr<T, Counter>& left, const SharedPtr<U, Counter>& right) {
+    return !(left == right);
 }
 
+// Ownership-based comparisons, see https://en.cppreference.com/w/cpp/memory/owner_less
+// Pointers sharing a control block are equivalent whatever they point to, so aliasing and weak
+// pointers work as keys, and weak ones need not be locked first. Any mix of `SharedPtr` and
+// `WeakPtr` can be compared.
+struct OwnerHash {
+    template <typename Ptr>
+    size_t operator()(const Ptr& ptr) const {
+        return std::hash<const void*>{}(ptr.block_);
+    }
+};
+struct OwnerEqual {
+    using is_transparent = void;
+
+    template <typename Left, typename Right>
+    bool operator()(const Left& left, const Right& right) const {
+        return left.block_ == right.block_;
+    }
+};
+struct OwnerLess {
+    using is_transparent = void;
+
+    template <typename Left, typename Right>
+    bool operator()(const Left& left, const Right& right) const {
+        return std::less<const void*>{}(left.block_, right.block_);
+    }
+};
+
 // Allocate memory only once
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    SharedPtr<T> new_shared;
-    ControlBlockObj<T>* new_block = new ControlBlockObj<T>(std::forward<Args>(args)...);
+// With `BlockLayout::kPadded` the object gets cache lines of its own, at the cost of a bigger
+// block: `MakeShared<T, AtomicCounter, BlockLayout::kPadded>(args...)`.
+template <typename T, typename Counter = SingleThreadCounter,
+          BlockLayout Layout = BlockLayout::kCompact, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T, Counter>> MakeShared(Args&&... args) {
+    SharedPtr<T, Counter> new_shared;
+    auto new_block = new ControlBlockObj<T, Counter, Layout>(std::forward<Args>(args)...);
+    SMART_PTRS_TRACE_EVENT(T, kConstruct);
     new_shared.block_ = new_block;
     new_shared.ptr_ = new_block->GetPtr();
+    AdoptObject(new_shared.block_, new_shared.ptr_);
     return new_shared;
 };
+
+// Same as `MakeShared`, but the single allocation is made by `alloc`
+template <typename T, typename Counter = SingleThreadCounter, typename Alloc, typename... Args>
+SharedPtr<T, Counter> AllocateShared(const Alloc& alloc, Args&&... args) {
+    using Block = ControlBlockAlloc<T, Alloc, Counter>;
+    using Traits = std::allocator_traits<typename Block::BlockAlloc>;
+    typename Block::BlockAlloc block_alloc(alloc);
+    Block* new_block = Traits::allocate(block_alloc, 1);
+    try {
+        ::new (new_block) Block(block_alloc, std::forward<Args>(args)...);
+    } catch (...) {
+        Traits::deallocate(block_alloc, new_block, 1);
+        throw;
+    }
+    SharedPtr<T, Counter> new_shared;
+    SMART_PTRS_TRACE_EVENT(T, kConstruct);
+    new_shared.block_ = new_block;
+    new_shared.ptr_ = new_block->GetPtr();
+    AdoptObject(new_shared.block_, new_shared.ptr_);
+    return new_shared;
+}
+
+// Shares an object that is never destroyed through `SharedPtr`, e.g. a global
+//     static ImmortalControlBlock<> block;
+//     static const Config kDefault{...};
+//     SharedPtr<const Config> config = MakeImmortal(&kDefault, &block);
+template <typename T, typename Counter>
+SharedPtr<T, Counter> MakeImmortal(T* ptr, ImmortalControlBlock<Counter>* block) {
+    SharedPtr<T, Counter> new_shared;
+    new_shared.block_ = block;
+    new_shared.ptr_ = ptr;
+    return new_shared;
+}
+
+// Control block, size and `size` value-initialized elements in one allocation
+template <typename T, typename Counter = SingleThreadCounter>
+std::enable_if_t<std::is_array_v<T> && !std::extent_v<T>, SharedPtr<T, Counter>> MakeShared(
+    size_t size) {
+    SharedPtr<T, Counter> new_shared;
+    auto new_block = ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(size, true);
+    SMART_PTRS_TRACE_EVENT(T, kConstruct);
+    new_shared.block_ = new_block;
+    new_shared.ptr_ = new_block->GetPtr();
+    return new_shared;
+}
+
+// Same, but the elements are default-initialized: trivial types are left as garbage to be
+// overwritten instead of being zeroed first
+template <typename T, typename Counter = SingleThreadCounter>
+std::enable_if_t<std::is_array_v<T> && !std::extent_v<T>, SharedPtr<T, Counter>>
+MakeSharedForOverwrite(size_t size) {
+    SharedPtr<T, Counter> new_shared;
+    auto new_block = ControlBlockArray<std::remove_extent_t<T>, Counter>::Create(size, false);
+    SMART_PTRS_TRACE_EVENT(T, kConstruct);
+    new_shared.block_ = new_block;
+    new_shared.ptr_ = new_block->GetPtr();
+    return new_shared;
+}
+
+// https://en.cppreference.com/w/cpp/memory/enable_shared_from_this
+// The weak reference is filled in by whoever first takes ownership of the object: `SharedPtr`
+// constructors, `Reset`, `MakeShared` and `AllocateShared`. Sharing from it is one increment.
+template <typename T, typename Counter>
+class EnableSharedFromThis {
+public:
+    SharedPtr<T, Counter> SharedFromThis() {
+        return SharedPtr<T, Counter>(weak_this_);
+    }
+    SharedPtr<const T, Counter> SharedFromThis() const {
+        return SharedPtr<T, Counter>(weak_this_);
+    }
+
+    WeakPtr<T, Counter> WeakFromThis() noexcept {
+        return weak_this_;
+    }
+    WeakPtr<const T, Counter> WeakFromThis() const noexcept {
+        return weak_this_;
+    }
+
+protected:
+    EnableSharedFromThis() noexcept {
+    }
+    // Copies are new objects, not owned by anybody yet
+    EnableSharedFromThis(const EnableSharedFromThis&) noexcept {
+    }
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) noexcept {
+        return *this;
+    }
+    ~EnableSharedFromThis() = default;
+
+private:
+    template <typename C, typename X, typename Y>
+    friend void SetWeakThis(BaseControlBlock<C>* block, const EnableSharedFromThis<X, C>* base,
+                            Y* ptr);
+
+    mutable WeakPtr<T, Counter> weak_this_;
+};
+
+template <typename Counter, typename X, typename Y>
+void SetWeakThis(BaseControlBlock<Counter>* block, const EnableSharedFromThis<X, Counter>* base,
+                 Y* ptr) {
+    // An object that is already owned keeps its first owner
+    if (!base || !base->weak_this_.Expired()) {
+        return;
+    }
+    base->weak_this_.Reset();
+    base->weak_this_.block_ = block;
+    base->weak_this_.ptr_ = const_cast<std::remove_cv_t<Y>*>(ptr);
+    block->IncWeakCnt();
+}
+
+namespace std {
+
+// Consistent with `operator==`: by the stored pointer
+template <typename T, typename Counter>
+struct hash<SharedPtr<T, Counter>> {
+    size_t operator()(const SharedPtr<T, Counter>& ptr) const {
+        return std::hash<typename SharedPtr<T, Counter>::ElementType*>{}(ptr.Get());
+    }
+};
+// `WeakPtr` has no value to hash without locking, so it is hashed by owner. Pair it with
+// `OwnerEqual`.
+template <typename T, typename Counter>
+struct hash<WeakPtr<T, Counter>> {
+    size_t operator()(const WeakPtr<T, Counter>& ptr) const {
+        return OwnerHash{}(ptr);
+    }
+};
+
+}  // namespace std
@@ -1,99 +1,471 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <unique/compressed_pair.h>
+#include <unique/unique.h>
+
+#ifdef SMART_PTRS_BLOCK_POOL
+#include "block_pool.h"
+#endif
+
+#ifdef SMART_PTRS_REGISTRY
+#include <common/live_registry.h>
+#endif
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// What dropping a strong reference left behind.
+enum class Release {
+    kAlive,          // Other strong references exist.
+    kLastShared,     // The object must go, weak references still need the block.
+    kLastReference,  // Nothing refers to the block anymore.
+};
+
+// Counting policies for the control blocks.
+// All `SharedPtr` owners together hold one extra weak reference, which the last of them drops
+// after the object is destroyed. So the block is freed exactly once: when the weak counter
+// reaches zero.
+class SingleThreadCounter {
+public:
+    size_t GetSharedCnt() const {
+        return shared_;
+    }
+    void IncSharedCnt() {
+        ++shared_;
+    }
+    // Takes a strong reference unless the object is already gone
+    bool TryIncSharedCnt() {
+        if (!shared_) {
+            return false;
+        }
+        ++shared_;
+        return true;
+    }
+    Release DecSharedCnt() {
+        if (--shared_) {
+            return Release::kAlive;
+        }
+        return weak_ == 1 ? Release::kLastReference : Release::kLastShared;
+    }
+    size_t GetWeakCnt() const {
+        return weak_ - (shared_ ? 1 : 0);
+    }
+    void IncWeakCnt() {
+        ++weak_;
+    }
+    size_t DecWeakCnt() {
+        return --weak_;
+    }
+
+private:
+    size_t shared_ = 1;
+    size_t weak_ = 1;
+};
+
+// Safe to share between threads: increments are relaxed, decrements release the owner's writes
+// and acquire everyone else's, so the one reaching zero sees them before destroying anything.
+class AtomicCounter {
+public:
+    size_t GetSharedCnt() const {
+        return shared_.load(std::memory_order_relaxed);
+    }
+    void IncSharedCnt() {
+        shared_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Never brings a count back from zero: the object may be being destroyed already
+    bool TryIncSharedCnt() {
+        size_t old = shared_.load(std::memory_order_relaxed);
+        do {
+            if (!old) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(old, old + 1, std::memory_order_relaxed));
+        return true;
+    }
+    Release DecSharedCnt() {
+        if (Dec(shared_)) {
+            return Release::kAlive;
+        }
+        return weak_.load(std::memory_order_acquire) == 1 ? Release::kLastReference
+                                                          : Release::kLastShared;
+    }
+    size_t GetWeakCnt() const {
+        return weak_.load(std::memory_order_relaxed) - (GetSharedCnt() ? 1 : 0);
+    }
+    void IncWeakCnt() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+    size_t DecWeakCnt() {
+        return Dec(weak_);
+    }
+
+private:
+    static size_t Dec(std::atomic<size_t>& counter) {
+        return counter.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    std::atomic<size_t> shared_ = 1;
+    std::atomic<size_t> weak_ = 1;
+};
+
+// Atomic counter packing both counts into one 64-bit word: strong in the low half, weak in the
+// high one. Dropping the sole reference is a single load, any other release is one RMW that
+// sees both counts at once. Each count is limited to 2^32 - 1.
+class PackedCounter {
+public:
+    size_t GetSharedCnt() const {
+        return Shared(word_.load(std::memory_order_relaxed));
+    }
+    void IncSharedCnt() {
+        word_.fetch_add(kOneShared, std::memory_order_relaxed);
+    }
+    bool TryIncSharedCnt() {
+        uint64_t old = word_.load(std::memory_order_relaxed);
+        do {
+            if (!Shared(old)) {
+                return false;
+            }
+        } while (!word_.compare_exchange_weak(old, old + kOneShared, std::memory_order_relaxed));
+        return true;
+    }
+    Release DecSharedCnt() {
+        if (word_.load(std::memory_order_acquire) == kOneShared + kOneWeak) {
+            return Release::kLastReference;
+        }
+        uint64_t old = word_.fetch_sub(kOneShared, std::memory_order_acq_rel);
+        if (Shared(old) != 1) {
+            return Release::kAlive;
+        }
+        return Weak(old) == 1 ? Release::kLastReference : Release::kLastShared;
+    }
+    size_t GetWeakCnt() const {
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        return Weak(word) - (Shared(word) ? 1 : 0);
+    }
+    void IncWeakCnt() {
+        word_.fetch_add(kOneWeak, std::memory_order_relaxed);
+    }
+    size_t DecWeakCnt() {
+        return Weak(word_.fetch_sub(kOneWeak, std::memory_order_acq_rel)) - 1;
+    }
+
+private:
+    static constexpr uint64_t kOneShared = 1;
+    static constexpr uint64_t kOneWeak = uint64_t{1} << 32;
+
+    static size_t Shared(uint64_t word) {
+        return word & (kOneWeak - 1);
+    }
+    static size_t Weak(uint64_t word) {
+        return word >> 32;
+    }
+
+    std::atomic<uint64_t> word_ = kOneShared + kOneWeak;
+};
+
+template <typename T, typename Counter = SingleThreadCounter>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Counter = SingleThreadCounter>
 class WeakPtr;
 
+template <typename T, typename Counter = SingleThreadCounter>
+class EnableSharedFromThis;
+
+// Opt-in counter of `cycle_collector.h`
+class CycleCounter;
+
+// What the type-erased hook of a control block is asked to do.
+enum class BlockOp { kDisposeObject, kDestroyBlock };
+
+// Counters live here and are touched without any indirection. Only the slow path (the last
+// strong or weak reference going away) goes through the `manage` hook set by the derived block.
+// Blocks without a hook are immortal, see `ImmortalControlBlock`.
+template <typename Counter>
 struct BaseControlBlock {
-    virtual size_t GetSharedCnt() = 0;
-    virtual void IncSharedCnt() = 0;
-    virtual void DecSharedCnt() = 0;
-    virtual size_t GetWeakCnt() = 0;
-    virtual void IncWeakCnt() = 0;
-    virtual void DecWeakCnt() = 0;
-    virtual ~BaseControlBlock() = default;
-};
-template <typename U>
-struct ControlBlockObj : public BaseControlBlock {
-    size_t shared_counter;
-    size_t weak_counter = 0;
-    std::aligned_storage_t<sizeof(U), alignof(U)> object;
-    template <typename... Args>
-    ControlBlockObj(Args&&... args) : shared_counter(1) {
-        new (static_cast<void*>(&object)) U(std::forward<Args>(args)...);
+    using ManageFn = void (*)(BaseControlBlock*, BlockOp);
+
+    constexpr explicit BaseControlBlock(ManageFn manage) : counter(), manage(manage) {
     }
-    size_t GetSharedCnt() override {
-        return shared_counter;
+#ifdef SMART_PTRS_BLOCK_POOL
+    // Picked up by every `new`/`delete` of a derived block
+    static void* operator new(size_t size) {
+        return BlockPool::Allocate(size);
     }
-    void IncSharedCnt() override {
-        ++shared_counter;
+    static void operator delete(void* ptr, size_t size) {
+        BlockPool::Deallocate(ptr, size);
     }
-    void DecSharedCnt() override {
-        --shared_counter;
-        if (!shared_counter) {
-            reinterpret_cast<U*>(&object)->~U();
-            if (!weak_counter) {
-                delete this;
-            }
+    // Over-aligned blocks bypass the pool
+    static void* operator new(size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+    static void operator delete(void* ptr, size_t, std::align_val_t align) {
+        ::operator delete(ptr, align);
+    }
+#endif
+    bool IsImmortal() const {
+        return !manage;
+    }
+    size_t GetSharedCnt() const {
+        return counter.GetSharedCnt();
+    }
+    void IncSharedCnt() {
+        if (!IsImmortal()) {
+            counter.IncSharedCnt();
+        }
+    }
+    // Used to promote weak references, which may race with the last strong one going away
+    bool TryIncSharedCnt() {
+        return IsImmortal() || counter.TryIncSharedCnt();
+    }
+    void DecSharedCnt() {
+        if (!IsImmortal()) {
+            Expire(counter.DecSharedCnt());
         }
     }
+    // Destroys the object, and the block too if nothing else refers to it. Does not touch the
+    // block for `kAlive`.
+    void Expire(Release release) {
+        if (release == Release::kAlive) {
+            return;
+        }
+        manage(this, BlockOp::kDisposeObject);
+        if (release == Release::kLastReference) {
+            DestroyBlock();
+        } else {
+            DecWeakCnt();
+        }
+    }
+    size_t GetWeakCnt() const {
+        return counter.GetWeakCnt();
+    }
+    void IncWeakCnt() {
+        if (!IsImmortal()) {
+            counter.IncWeakCnt();
+        }
+    }
+    void DecWeakCnt() {
+        if (!IsImmortal() && !counter.DecWeakCnt()) {
+            DestroyBlock();
+        }
+    }
+    void DestroyBlock() {
+#ifdef SMART_PTRS_REGISTRY
+        live.Unlink();
+#endif
+        manage(this, BlockOp::kDestroyBlock);
+    }
+
+    // Called by the derived blocks once their object is constructed
+    template <typename U>
+    void LinkLive([[maybe_unused]] size_t bytes) {
+#ifdef SMART_PTRS_REGISTRY
+        live.Link(&DescribeLive<U>, this, bytes);
+#endif
+    }
+
+    Counter counter;
+    ManageFn manage;
+#ifdef SMART_PTRS_REGISTRY
+    LiveNode live;
+
+    template <typename U>
+    static void DescribeLive(const void* owner, const std::type_info*& type, size_t& strong,
+                             size_t& weak) {
+        auto block = static_cast<const BaseControlBlock*>(owner);
+        type = &typeid(U);
+        strong = block->GetSharedCnt();
+        weak = block->GetWeakCnt();
+    }
+#endif
+};
+
+// Block of an object that outlives every pointer to it, e.g. a global. Copying and dropping
+// pointers to it never write to the block, so it costs no cache-line traffic. Can be
+// constant-initialized with every counter but `BiasedCounter`, which registers its thread.
+template <typename Counter = SingleThreadCounter>
+struct ImmortalControlBlock : public BaseControlBlock<Counter> {
+    constexpr ImmortalControlBlock() : BaseControlBlock<Counter>(nullptr) {
+    }
+};
+
+// Assumed size of a cache line, the unit in which cores invalidate each other's caches
+inline constexpr size_t kCacheLineSize = 64;
+
+// Where `MakeShared` places the object relative to the counters.
+enum class BlockLayout {
+    kCompact,  // Right after the counters, often on the same cache line.
+    kPadded,   // On the next cache line, so counter updates do not disturb readers of the object.
+};
+
+template <typename U, typename Counter = SingleThreadCounter,
+          BlockLayout Layout = BlockLayout::kCompact>
+struct ControlBlockObj : public BaseControlBlock<Counter> {
+    static constexpr size_t kObjectAlign =
+        Layout == BlockLayout::kPadded ? std::max(alignof(U), kCacheLineSize) : alignof(U);
+
+    std::aligned_storage_t<sizeof(U), kObjectAlign> object;
+    template <typename... Args>
+    ControlBlockObj(Args&&... args) : BaseControlBlock<Counter>(&Manage) {
+        new (static_cast<void*>(&object)) U(std::forward<Args>(args)...);
+        this->template LinkLive<U>(sizeof(ControlBlockObj));
+    }
     U* GetPtr() {
         return reinterpret_cast<U*>(&object);
     }
-    size_t GetWeakCnt() override {
-        return weak_counter;
+    static void Manage(BaseControlBlock<Counter>* base, BlockOp op) {
+        auto block = static_cast<ControlBlockObj*>(base);
+        if (op == BlockOp::kDisposeObject) {
+            block->GetPtr()->~U();
+        } else {
+            delete block;
+        }
+    }
+};
+template <typename U, typename Counter = SingleThreadCounter, typename Deleter = DefaultDeleter<U>>
+struct ControlBlockPtr : public BaseControlBlock<Counter> {
+    CompressedPair<U*, Deleter> ptr_and_del;
+    ControlBlockPtr(U* inptr) : BaseControlBlock<Counter>(&Manage), ptr_and_del(inptr, Deleter{}) {
+        this->template LinkLive<U>(LiveBytes());
+    }
+    template <typename OtherDeleter>
+    ControlBlockPtr(U* inptr, OtherDeleter&& deleter)
+        : BaseControlBlock<Counter>(&Manage),
+          ptr_and_del(inptr, std::forward<OtherDeleter>(deleter)) {
+        this->template LinkLive<U>(LiveBytes());
     }
-    void IncWeakCnt() override {
-        ++weak_counter;
+    static void Manage(BaseControlBlock<Counter>* base, BlockOp op) {
+        auto block = static_cast<ControlBlockPtr*>(base);
+        if (op == BlockOp::kDisposeObject) {
+            block->ptr_and_del.GetSecond()(block->ptr_and_del.GetFirst());
+            block->ptr_and_del.GetFirst() = nullptr;
+        } else {
+            delete block;
+        }
     }
-    void DecWeakCnt() override {
-        --weak_counter;
+
+private:
+    // The object is allocated separately; an adopted array is counted as one element
+    static size_t LiveBytes() {
+        return sizeof(ControlBlockPtr) + sizeof(U);
     }
 };
+
+// Uninitialized room for one `U`, not zeroed on construction.
 template <typename U>
-struct ControlBlockPtr : public BaseControlBlock {
-    size_t shared_counter;
-    size_t weak_counter = 0;
-    U* ptr;
-    bool is_deleted = false;
-    ControlBlockPtr(U* inptr) : ptr(inptr), shared_counter(1) {
-    }
-    size_t GetSharedCnt() override {
-        return shared_counter;
-    }
-    void IncSharedCnt() override {
-        ++shared_counter;
-    }
-    void DecSharedCnt() override {
-        --shared_counter;
-        if (!shared_counter) {
-            if (!weak_counter) {
-                delete this;
+struct ObjectStorage {
+    ObjectStorage() {
+    }
+    U* Get() {
+        return reinterpret_cast<U*>(&data);
+    }
+    std::aligned_storage_t<sizeof(U), alignof(U)> data;
+};
+// Like `ControlBlockObj`, but the memory comes from `Alloc`. A copy of the allocator lives in the
+// block (taking no space when it is stateless) so that the block can give itself back.
+template <typename U, typename Alloc, typename Counter = SingleThreadCounter>
+struct ControlBlockAlloc : public BaseControlBlock<Counter> {
+    using BlockAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockAlloc>;
+    using ObjectAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<U>;
+
+    CompressedPair<BlockAlloc, ObjectStorage<U>> alloc_and_object;
+    template <typename... Args>
+    ControlBlockAlloc(const BlockAlloc& alloc, Args&&... args)
+        : BaseControlBlock<Counter>(&Manage), alloc_and_object(alloc) {
+        ObjectAlloc object_alloc(alloc);
+        std::allocator_traits<ObjectAlloc>::construct(object_alloc, GetPtr(),
+                                                      std::forward<Args>(args)...);
+        this->template LinkLive<U>(sizeof(ControlBlockAlloc));
+    }
+    U* GetPtr() {
+        return alloc_and_object.GetSecond().Get();
+    }
+    static void Manage(BaseControlBlock<Counter>* base, BlockOp op) {
+        auto block = static_cast<ControlBlockAlloc*>(base);
+        if (op == BlockOp::kDisposeObject) {
+            ObjectAlloc object_alloc(block->alloc_and_object.GetFirst());
+            std::allocator_traits<ObjectAlloc>::destroy(object_alloc, block->GetPtr());
+        } else {
+            BlockAlloc alloc(std::move(block->alloc_and_object.GetFirst()));
+            block->~ControlBlockAlloc();
+            std::allocator_traits<BlockAlloc>::deallocate(alloc, block, 1);
+        }
+    }
+};
+
+// Control block followed by `size` elements, all in one allocation.
+template <typename U, typename Counter = SingleThreadCounter>
+struct ControlBlockArray : public BaseControlBlock<Counter> {
+    size_t size;
+    ControlBlockArray(size_t size) : BaseControlBlock<Counter>(&Manage), size(size) {
+    }
+    // Throws `std::bad_array_new_length` if `size` elements don't fit in `size_t` bytes
+    static ControlBlockArray* Create(size_t size, bool value_init) {
+        if (size > (std::numeric_limits<size_t>::max() - ElementsOffset()) / sizeof(U)) {
+            throw std::bad_array_new_length();
+        }
+        size_t bytes = ElementsOffset() + size * sizeof(U);
+        void* memory = Allocate(bytes);
+        auto block = ::new (memory) ControlBlockArray(size);
+        try {
+            if (value_init) {
+                std::uninitialized_value_construct_n(block->GetPtr(), size);
             } else {
-                delete ptr;
-                ptr = nullptr;
+                std::uninitialized_default_construct_n(block->GetPtr(), size);
             }
+        } catch (...) {
+            block->~ControlBlockArray();
+            Deallocate(memory);
+            throw;
         }
+        block->template LinkLive<U>(bytes);
+        return block;
+    }
+    U* GetPtr() {
+        return reinterpret_cast<U*>(reinterpret_cast<char*>(this) + ElementsOffset());
     }
-    size_t GetWeakCnt() override {
-        return weak_counter;
+    static void Manage(BaseControlBlock<Counter>* base, BlockOp op) {
+        auto block = static_cast<ControlBlockArray*>(base);
+        if (op == BlockOp::kDisposeObject) {
+            std::destroy_n(block->GetPtr(), block->size);
+        } else {
+            block->~ControlBlockArray();
+            Deallocate(block);
+        }
     }
-    void IncWeakCnt() override {
-        ++weak_counter;
+
+private:
+    static constexpr size_t kAlign = std::max(alignof(U), alignof(BaseControlBlock<Counter>));
+    static constexpr bool kOverAligned = kAlign > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static size_t ElementsOffset() {
+        return (sizeof(ControlBlockArray) + alignof(U) - 1) / alignof(U) * alignof(U);
     }
-    void DecWeakCnt() override {
-        --weak_counter;
+    static void* Allocate(size_t bytes) {
+        if constexpr (kOverAligned) {
+            return ::operator new(bytes, std::align_val_t{kAlign});
+        } else {
+            return ::operator new(bytes);
+        }
     }
-    ~ControlBlockPtr() override {
-        if (ptr) {
-            delete ptr;
-            ptr = nullptr;
+    static void Deallocate(void* memory) {
+        if constexpr (kOverAligned) {
+            ::operator delete(memory, std::align_val_t{kAlign});
+        } else {
+            ::operator delete(memory);
         }
     }
-};
\ No newline at end of file
+};
+
+// Needs `BaseControlBlock`
+#include "biased_counter.h"
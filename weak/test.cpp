@@ -7,6 +7,11 @@
 
 #include "allocations_checker.h"
 
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST_CASE("Empty weak") {
@@ -175,3 +180,157 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEMPLATE_TEST_CASE("Thread-safe counters", "", AtomicCounter, PackedCounter, BiasedCounter) {
+    SECTION("Same semantics") {
+        WeakPtr<MyInt, TestType> wp;
+        {
+            auto sp = MakeShared<MyInt, TestType>(42);
+            SharedPtr<MyInt, TestType> sp2(sp);
+            wp = sp;
+            REQUIRE(wp.UseCount() == 2);
+            REQUIRE(*wp.Lock() == 42);
+        }
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Copies from many threads") {
+        SharedPtr<MyInt, TestType> sp(new MyInt(42));
+        WeakPtr<MyInt, TestType> wp(sp);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([sp, wp] {
+                for (int j = 0; j < 10000; ++j) {
+                    SharedPtr<MyInt, TestType> copy(sp);
+                    WeakPtr<MyInt, TestType> weak_copy(wp);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Lock racing with the last release") {
+        for (int round = 0; round < 200; ++round) {
+            auto sp = MakeShared<MyInt, TestType>(42);
+            WeakPtr<MyInt, TestType> wp(sp);
+            std::atomic<bool> wrong_value = false;
+            std::thread locker([wp, &wrong_value] {
+                while (auto locked = wp.Lock()) {
+                    if (!(*locked == 42)) {
+                        wrong_value = true;
+                    }
+                }
+            });
+            sp.Reset();
+            locker.join();
+            REQUIRE(!wrong_value);
+            using Shared = SharedPtr<MyInt, TestType>;
+            REQUIRE_THROWS_AS(Shared(wp), BadWeakPtr);
+        }
+        BiasedCounter::MergeQueued();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+}
+
+TEST_CASE("Packed control block size") {
+    REQUIRE(sizeof(ControlBlockPtr<int, PackedCounter>) == 3 * sizeof(void*));
+    REQUIRE(sizeof(ControlBlockObj<int, PackedCounter>) == 3 * sizeof(void*));
+}
+
+TEST_CASE("Padded layout") {
+    WeakPtr<MyInt, AtomicCounter> weak;
+    {
+        auto sp = MakeShared<MyInt, AtomicCounter, BlockLayout::kPadded>(42);
+        weak = sp;
+        auto block = reinterpret_cast<uintptr_t>(sp.block_);
+        auto object = reinterpret_cast<uintptr_t>(sp.Get());
+        REQUIRE(object % kCacheLineSize == 0);
+        REQUIRE(object - block >= sizeof(BaseControlBlock<AtomicCounter>));
+        REQUIRE(object / kCacheLineSize != block / kCacheLineSize);
+        REQUIRE(*sp == 42);
+        REQUIRE(MyInt::AliveCount() == 1);
+    }
+    REQUIRE(weak.Expired());
+    REQUIRE(MyInt::AliveCount() == 0);
+}
+
+TEST_CASE("Biased counter") {
+    SECTION("Owner-only references") {
+        WeakPtr<MyInt, BiasedCounter> wp;
+        {
+            auto sp = MakeShared<MyInt, BiasedCounter>(42);
+            auto sp2 = sp;
+            wp = sp2;
+            REQUIRE(sp.UseCount() == 2);
+        }
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Last reference dropped by another thread") {
+        auto sp = MakeShared<MyInt, BiasedCounter>(42);
+        WeakPtr<MyInt, BiasedCounter> wp(sp);
+        std::thread([moved = std::move(sp)]() mutable { moved.Reset(); }).join();
+        // Still counted by the owner until it merges its queue
+        REQUIRE(MyInt::AliveCount() == 1);
+        BiasedCounter::MergeQueued();
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(wp.Expired());
+    }
+
+    SECTION("Owner drops last after others") {
+        auto sp = MakeShared<MyInt, BiasedCounter>(42);
+        std::thread([copy = sp]() mutable {
+            auto another = copy;
+            copy.Reset();
+        }).join();
+        REQUIRE(sp.UseCount() == 1);
+        sp.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Handed over by an exited owner") {
+        // This thread has a record of its own, so it won't take over the worker's
+        auto mine = MakeShared<MyInt, BiasedCounter>(1);
+        SharedPtr<MyInt, BiasedCounter> escaped;
+        std::thread([&escaped] { escaped = MakeShared<MyInt, BiasedCounter>(42); }).join();
+        WeakPtr<MyInt, BiasedCounter> wp(escaped);
+        REQUIRE(escaped.UseCount() == 1);
+        escaped.Reset();
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 1);
+    }
+
+    SECTION("Queued to an owner that exits") {
+        auto mine = MakeShared<MyInt, BiasedCounter>(1);
+        std::atomic<int> step = 0;
+        SharedPtr<MyInt, BiasedCounter> escaped;
+        std::thread owner([&] {
+            escaped = MakeShared<MyInt, BiasedCounter>(42);
+            step = 1;
+            while (step != 2) {
+                std::this_thread::yield();
+            }
+        });
+        while (step != 1) {
+            std::this_thread::yield();
+        }
+        WeakPtr<MyInt, BiasedCounter> wp(escaped);
+        escaped.Reset();
+        // Still counted by the owner, which merges its queue on the way out
+        REQUIRE(MyInt::AliveCount() == 2);
+        step = 2;
+        owner.join();
+        REQUIRE(wp.Expired());
+        REQUIRE(MyInt::AliveCount() == 1);
+    }
+}
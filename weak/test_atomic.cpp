@@ -0,0 +1,109 @@
+#include "atomic_shared.h"
+
+#include <common/my_int.h>
+
+#include <catch.hpp>
+
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Tracked {
+    Tracked(int value) : value(value) {
+        ++alive;
+    }
+    ~Tracked() {
+        --alive;
+    }
+
+    int value;
+    inline static std::atomic<int> alive = 0;
+};
+
+TEST_CASE("AtomicSharedPtr basics") {
+    SECTION("Empty") {
+        AtomicSharedPtr<int> slot;
+        REQUIRE(slot.Load().Get() == nullptr);
+    }
+
+    SECTION("Load/Store/Exchange") {
+        {
+            AtomicSharedPtr<MyInt> slot(MakeShared<MyInt, AtomicCounter>(1));
+            auto first = slot.Load();
+            REQUIRE(*first == 1);
+            REQUIRE(first.UseCount() == 2);
+
+            slot.Store(MakeShared<MyInt, AtomicCounter>(2));
+            REQUIRE(first.UseCount() == 1);
+            REQUIRE(*slot.Load() == 2);
+
+            auto second = slot.Exchange(SharedPtr<MyInt, AtomicCounter>());
+            REQUIRE(*second == 2);
+            REQUIRE(second.UseCount() == 1);
+            REQUIRE(slot.Load().Get() == nullptr);
+
+            slot.Store(second);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("CompareExchange") {
+        auto first = MakeShared<int, AtomicCounter>(1);
+        auto second = MakeShared<int, AtomicCounter>(2);
+        AtomicSharedPtr<int> slot(first);
+
+        SharedPtr<int, AtomicCounter> expected = second;
+        REQUIRE(!slot.CompareExchange(expected, second));
+        REQUIRE(expected.Get() == first.Get());
+
+        REQUIRE(slot.CompareExchange(expected, second));
+        REQUIRE(slot.Load().Get() == second.Get());
+        REQUIRE(first.UseCount() == 2);
+        REQUIRE(second.UseCount() == 2);
+
+        SharedPtr<int, AtomicCounter> empty;
+        REQUIRE(!slot.CompareExchange(empty, first));
+        REQUIRE(empty.Get() == second.Get());
+    }
+}
+
+TEST_CASE("AtomicSharedPtr under concurrency") {
+    {
+        AtomicSharedPtr<Tracked> slot(MakeShared<Tracked, AtomicCounter>(0));
+        std::atomic<bool> stop = false;
+        std::atomic<int> empty_loads = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; ++i) {
+            readers.emplace_back([&] {
+                while (!stop) {
+                    if (!slot.Load()) {
+                        ++empty_loads;
+                    }
+                }
+            });
+        }
+        std::vector<std::thread> writers;
+        for (int i = 0; i < 2; ++i) {
+            writers.emplace_back([&slot, i] {
+                for (int j = 0; j < 10000; ++j) {
+                    if (j % 2) {
+                        slot.Store(MakeShared<Tracked, AtomicCounter>(j));
+                    } else {
+                        auto expected = slot.Load();
+                        slot.CompareExchange(expected, MakeShared<Tracked, AtomicCounter>(i));
+                    }
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        stop = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE(empty_loads == 0);
+    }
+    REQUIRE(Tracked::alive == 0);
+}
@@ -0,0 +1,72 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+// Built with SMART_PTRS_BLOCK_POOL defined
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Pooled control blocks") {
+    SECTION("Freed blocks are reused") {
+        { auto warm_up = MakeShared<int>(1); }
+        auto before = BlockPool::GetStats();
+        REQUIRE(before.bytes_cached > 0);
+
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*MakeShared<int>(42) == 42));
+        auto after = BlockPool::GetStats();
+        REQUIRE(after.hits == before.hits + 1);
+        REQUIRE(after.misses == before.misses);
+    }
+
+    SECTION("Owned pointers and weak references") {
+        WeakPtr<std::string> weak;
+        {
+            SharedPtr<std::string> shared(new std::string("aba"));
+            weak = shared;
+        }
+        REQUIRE(weak.Expired());
+        auto cached = BlockPool::GetStats().bytes_cached;
+        weak.Reset();
+        REQUIRE(BlockPool::GetStats().bytes_cached > cached);
+    }
+
+    SECTION("Cross-thread frees come back") {
+        std::vector<SharedPtr<int, AtomicCounter>> blocks;
+        std::thread producer([&blocks] {
+            for (int i = 0; i < 1000; ++i) {
+                blocks.push_back(MakeShared<int, AtomicCounter>(i));
+            }
+        });
+        producer.join();
+
+        auto before = BlockPool::GetStats();
+        std::thread consumer([&blocks] { blocks.clear(); });
+        consumer.join();
+        auto after = BlockPool::GetStats();
+        REQUIRE(after.bytes_cached >= before.bytes_cached + 1000 * sizeof(ControlBlockObj<int>));
+
+        for (int i = 0; i < 1000; ++i) {
+            blocks.push_back(MakeShared<int, AtomicCounter>(i));
+        }
+        REQUIRE(BlockPool::GetStats().misses == after.misses);
+    }
+
+    SECTION("Over-aligned blocks bypass the pool") {
+        struct alignas(64) Wide {
+            int value = 0;
+        };
+        auto before = BlockPool::GetStats();
+        auto wide = MakeShared<Wide>();
+        REQUIRE(reinterpret_cast<uintptr_t>(wide.Get()) % 64 == 0);
+        auto after = BlockPool::GetStats();
+        REQUIRE(after.hits == before.hits);
+        REQUIRE(after.misses == before.misses);
+    }
+}
@@ -0,0 +1,145 @@
+#include "weak_value_cache.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("WeakValueCache hits and misses") {
+    WeakValueCache<int, std::string> cache;
+    int created = 0;
+    auto factory = [&created] {
+        ++created;
+        return MakeShared<std::string, AtomicCounter>("asset");
+    };
+
+    auto first = cache.GetOrCreate(1, factory);
+    auto second = cache.GetOrCreate(1, factory);
+    REQUIRE(created == 1);
+    REQUIRE(first.Get() == second.Get());
+    REQUIRE(cache.Get(1).Get() == first.Get());
+    REQUIRE(!cache.Get(2));
+
+    first.Reset();
+    second.Reset();
+    REQUIRE(!cache.Get(1));
+    auto third = cache.GetOrCreate(1, factory);
+    REQUIRE(created == 2);
+    REQUIRE(*third == "asset");
+
+    cache.Erase(1);
+    REQUIRE(!cache.Get(1));
+    REQUIRE(*third == "asset");
+}
+
+TEST_CASE("WeakValueCache with no shards asked for") {
+    WeakValueCache<int, std::string> cache(0);
+    auto value = cache.GetOrCreate(1, [] { return MakeShared<std::string, AtomicCounter>("one"); });
+    REQUIRE(cache.Get(1).Get() == value.Get());
+    REQUIRE(cache.Size() == 1);
+}
+
+TEST_CASE("WeakValueCache does not keep values alive") {
+    WeakValueCache<int, std::string> cache(1);
+    for (int i = 0; i < 1000; ++i) {
+        cache.GetOrCreate(i, [] { return MakeShared<std::string, AtomicCounter>("temporary"); });
+    }
+    // Each operation sweeps a few entries, so dead ones do not pile up
+    REQUIRE(cache.Size() < 1000);
+    for (int i = 0; i < 2000; ++i) {
+        cache.Get(-1);
+    }
+    REQUIRE(cache.Size() == 0);
+}
+
+TEST_CASE("WeakValueCache sweeps past live entries in a bucket") {
+    struct OneBucket {
+        size_t operator()(int) const {
+            return 0;
+        }
+    };
+    WeakValueCache<int, int, AtomicCounter, OneBucket> cache(1);
+    auto factory = [] { return MakeShared<int, AtomicCounter>(0); };
+    // Entries added later come first in the bucket, as long as the map is not rehashed (few
+    // enough entries): the dead ones end up behind more live ones than a sweep looks at
+    std::vector<SharedPtr<int, AtomicCounter>> dying;
+    for (int i = 0; i < 8; ++i) {
+        dying.push_back(cache.GetOrCreate(i, factory));
+    }
+    std::vector<SharedPtr<int, AtomicCounter>> kept;
+    for (int i = 8; i < 13; ++i) {
+        kept.push_back(cache.GetOrCreate(i, factory));
+    }
+    dying.clear();
+    REQUIRE(cache.Size() == 13);
+    for (int i = 0; i < 100; ++i) {
+        cache.Get(-1);
+    }
+    REQUIRE(cache.Size() == 5);
+}
+
+TEST_CASE("WeakValueCache sweep starts a new bucket from its first entry") {
+    // Keys 0-99 go to bucket 0, 100-199 to bucket 1
+    struct ByHundreds {
+        size_t operator()(int key) const {
+            return key / 100;
+        }
+    };
+    WeakValueCache<int, int, AtomicCounter, ByHundreds> cache(1);
+    auto factory = [] { return MakeShared<int, AtomicCounter>(0); };
+    std::vector<SharedPtr<int, AtomicCounter>> next_bucket;
+    for (int i = 100; i < 104; ++i) {
+        next_bucket.push_back(cache.GetOrCreate(i, factory));
+    }
+    auto second = cache.GetOrCreate(1, factory);
+    auto first = cache.GetOrCreate(0, factory);
+    // With 13 buckets, these calls leave the sweep two steps before bucket 0
+    for (int i = 0; i < 6; ++i) {
+        cache.Get(-1);
+    }
+    second.Reset();
+    next_bucket.clear();
+    // Looks at `first`, then removes `second` and stops, one entry into bucket 0
+    cache.Get(-1);
+    REQUIRE(cache.Size() == 5);
+    // Empties bucket 0 under the sweep, which then moves on to bucket 1
+    cache.Erase(0);
+    cache.Get(-1);
+    REQUIRE(cache.Size() == 0);
+}
+
+TEST_CASE("WeakValueCache from many threads") {
+    WeakValueCache<int, int> cache;
+    std::atomic<int> created = 0;
+    std::atomic<int> mismatches = 0;
+    std::vector<SharedPtr<int, AtomicCounter>> kept(4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 10000; ++i) {
+                auto value = cache.GetOrCreate(i % 64, [&created, i] {
+                    ++created;
+                    return MakeShared<int, AtomicCounter>(i % 64);
+                });
+                if (*value != i % 64) {
+                    ++mismatches;
+                }
+                if (i % 64 == 0) {
+                    kept[t] = value;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(mismatches == 0);
+    for (const auto& value : kept) {
+        REQUIRE(value.Get() == kept[0].Get());
+    }
+    REQUIRE(created >= 64);
+}
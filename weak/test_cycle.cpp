@@ -0,0 +1,197 @@
+#include "cycle_collector.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct GraphNode {
+    inline static int alive = 0;
+
+    GraphNode() {
+        ++alive;
+    }
+    ~GraphNode() {
+        --alive;
+    }
+
+    std::vector<SharedPtr<GraphNode, CycleCounter>> edges;
+    SharedPtr<int, CycleCounter> payload;
+};
+
+template <>
+struct CycleEdges<GraphNode> {
+    template <typename Visitor>
+    static void ForEach(GraphNode& node, Visitor&& visit) {
+        for (auto& edge : node.edges) {
+            visit(edge);
+        }
+        visit(node.payload);
+    }
+};
+
+using Node = SharedPtr<GraphNode, CycleCounter>;
+
+// Drops a ring of `size` nodes, each of them a candidate. Returns one of its nodes.
+GraphNode* MakeRing(int size) {
+    auto first = MakeShared<GraphNode, CycleCounter>();
+    Node last = first;
+    for (int i = 1; i < size; ++i) {
+        auto next = MakeShared<GraphNode, CycleCounter>();
+        last->edges.push_back(next);
+        last = next;
+        auto copy = next;
+    }
+    last->edges.push_back(first);
+    return first.Get();
+}
+
+TEST_CASE("Cycle collector") {
+    CycleCollector::CollectAll();
+    REQUIRE(GraphNode::alive == 0);
+
+    SECTION("Self-loop") {
+        auto node = MakeShared<GraphNode, CycleCounter>();
+        node->edges.push_back(node);
+        node.Reset();
+        REQUIRE(GraphNode::alive == 1);
+        REQUIRE(CycleCollector::CollectAll() == 1);
+        REQUIRE(GraphNode::alive == 0);
+    }
+
+    SECTION("Two nodes and their payload") {
+        WeakPtr<int, CycleCounter> payload;
+        {
+            Node a(new GraphNode);
+            auto b = MakeShared<GraphNode, CycleCounter>();
+            a->edges.push_back(b);
+            b->edges.push_back(a);
+            b->payload = MakeShared<int, CycleCounter>(42);
+            payload = b->payload;
+        }
+        REQUIRE(GraphNode::alive == 2);
+        REQUIRE(CycleCollector::CollectAll() == 3);
+        REQUIRE(GraphNode::alive == 0);
+        REQUIRE(payload.Expired());
+    }
+
+    SECTION("Referenced cycles survive") {
+        auto a = MakeShared<GraphNode, CycleCounter>();
+        {
+            auto b = MakeShared<GraphNode, CycleCounter>();
+            a->edges.push_back(b);
+            b->edges.push_back(a);
+        }
+        REQUIRE(CycleCollector::CollectAll() == 0);
+        REQUIRE(GraphNode::alive == 2);
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(a->edges[0].UseCount() == 1);
+
+        a.Reset();
+        REQUIRE(CycleCollector::CollectAll() == 2);
+        REQUIRE(GraphNode::alive == 0);
+    }
+
+    SECTION("Acyclic garbage is freed without the collector") {
+        {
+            auto a = MakeShared<GraphNode, CycleCounter>();
+            a->edges.push_back(MakeShared<GraphNode, CycleCounter>());
+        }
+        REQUIRE(GraphNode::alive == 0);
+        REQUIRE(CycleCollector::CollectAll() == 0);
+        REQUIRE(CycleCollector::CandidateCount() == 0);
+    }
+
+    SECTION("Weak references do not count") {
+        auto a = MakeShared<GraphNode, CycleCounter>();
+        a->edges.push_back(a);
+        WeakPtr<GraphNode, CycleCounter> weak(a);
+        a.Reset();
+        REQUIRE(weak.UseCount() == 1);
+        CycleCollector::CollectAll();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Long ring, collected within a budget") {
+        constexpr int kSize = 100000;
+        MakeRing(kSize);
+        REQUIRE(GraphNode::alive == kSize);
+        REQUIRE(CycleCollector::CandidateCount() > 1);
+
+        // With no time to spend, each call does one round of `kStepsPerCheck` steps: the ring
+        // is traced and freed over many calls, a step per object freed
+        size_t calls = 0;
+        size_t freed = 0;
+        size_t most_freed = 0;
+        while (CycleCollector::CandidateCount()) {
+            size_t now_freed = CycleCollector::Collect(std::chrono::nanoseconds(0));
+            freed += now_freed;
+            most_freed = std::max(most_freed, now_freed);
+            ++calls;
+        }
+        REQUIRE(GraphNode::alive == 0);
+        REQUIRE(freed == kSize);
+        REQUIRE(most_freed < kSize);
+        REQUIRE(most_freed <= CycleCollector::kStepsPerCheck);
+        REQUIRE(calls > 10);
+    }
+
+    SECTION("Changes between calls restart the trace") {
+        constexpr int kSize = 10000;
+        GraphNode* first = MakeRing(kSize);
+        // Partway through tracing the ring
+        for (int i = 0; i < 10; ++i) {
+            REQUIRE(CycleCollector::Collect(std::chrono::nanoseconds(0)) == 0);
+        }
+
+        SECTION("A reference taken") {
+            WeakPtr<GraphNode, CycleCounter> weak(first->edges[0]);
+            auto kept = weak.Lock();
+            REQUIRE(CycleCollector::CollectAll() == 0);
+            REQUIRE(GraphNode::alive == kSize);
+            kept.Reset();
+        }
+
+        SECTION("An edge moved out") {
+            auto kept = std::move(first->edges[0]);
+            first->edges.clear();
+            REQUIRE(CycleCollector::CollectAll() == 0);
+            REQUIRE(GraphNode::alive == kSize);
+            // No cycle is left
+            kept.Reset();
+            REQUIRE(GraphNode::alive == 0);
+        }
+
+        SECTION("An edge container moved out") {
+            // No pointer is touched, the garbage check before freeing catches it
+            auto kept = std::move(first->edges);
+            REQUIRE(CycleCollector::CollectAll() == 0);
+            REQUIRE(GraphNode::alive == kSize);
+            REQUIRE(kept[0]->edges[0]);
+            kept.clear();
+            REQUIRE(GraphNode::alive == 0);
+        }
+
+        CycleCollector::CollectAll();
+        REQUIRE(GraphNode::alive == 0);
+    }
+
+    SECTION("Garbage being freed can't be locked") {
+        constexpr int kSize = 10000;
+        GraphNode* first = MakeRing(kSize);
+        WeakPtr<GraphNode, CycleCounter> weak(first->edges[0]);
+        size_t freed = 0;
+        while (!freed) {
+            freed = CycleCollector::Collect(std::chrono::nanoseconds(0));
+        }
+        REQUIRE(freed < kSize);
+        REQUIRE(GraphNode::alive > 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(!weak.Lock());
+        CycleCollector::CollectAll();
+        REQUIRE(GraphNode::alive == 0);
+    }
+}
@@ -0,0 +1,137 @@
+#include <common/recording_allocator.h>
+
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Memory taken by control blocks, in bytes. Sizes are pinned for 64-bit targets, so a control
+// block that grows fails here. `MakeShared` and the pointer constructors go through the global
+// `operator new`, which this program records; `AllocateShared` goes through an allocator that
+// records every request too.
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if UINTPTR_MAX == UINT64_MAX
+
+// Counter and `manage`
+template <typename Counter>
+constexpr size_t kHeaderBytes = 0;
+template <>
+constexpr size_t kHeaderBytes<SingleThreadCounter> = 24;
+template <>
+constexpr size_t kHeaderBytes<AtomicCounter> = 24;
+template <>
+constexpr size_t kHeaderBytes<PackedCounter> = 16;
+// Owner and home threads, both counts, weak count and the link in its owner's queue
+template <>
+constexpr size_t kHeaderBytes<BiasedCounter> = 56;
+
+TEMPLATE_TEST_CASE("Control block sizes", "", SingleThreadCounter, AtomicCounter, PackedCounter,
+                   BiasedCounter) {
+    constexpr size_t kHeader = kHeaderBytes<TestType>;
+    REQUIRE(sizeof(BaseControlBlock<TestType>) == kHeader);
+
+    // `MakeShared` adds nothing but the object
+    REQUIRE(sizeof(ControlBlockObj<int, TestType>) == kHeader + 8);
+    REQUIRE(sizeof(ControlBlockObj<std::string, TestType>) == kHeader + 32);
+
+    // Pointer constructors add the pointer, and stateless deleters take no space
+    REQUIRE(sizeof(ControlBlockPtr<int, TestType>) == kHeader + 8);
+    REQUIRE(sizeof(ControlBlockPtr<int, TestType, void (*)(int*)>) == kHeader + 16);
+
+    // Arrays add their size ahead of the elements
+    REQUIRE(sizeof(ControlBlockArray<int, TestType>) == kHeader + 8);
+}
+
+TEMPLATE_TEST_CASE("Heap taken by new pointers", "", SingleThreadCounter, AtomicCounter,
+                   PackedCounter, BiasedCounter) {
+    constexpr size_t kHeader = kHeaderBytes<TestType>;
+    // A biased counter sets up its thread's state on first use; that isn't per pointer
+    MakeShared<int, TestType>(0);
+
+    // One block with the object in it
+    EXPECT_AT_MOST_BYTES((MakeShared<int, TestType>(42)), kHeader + 8);
+    EXPECT_AT_MOST_BYTES((MakeShared<std::string, TestType>("short")), kHeader + 32);
+
+    // The object, then a block pointing at it
+    EXPECT_AT_MOST_BYTES((SharedPtr<int, TestType>(new int(42))), 4 + kHeader + 8);
+    EXPECT_NO_ALLOCATION_LARGER_THAN((SharedPtr<int, TestType>(new int(42))), kHeader + 8);
+
+    // Elements right after the block
+    EXPECT_AT_MOST_BYTES((MakeShared<int[], TestType>(10)), kHeader + 8 + 10 * sizeof(int));
+
+    // Weak pointers allocate nothing
+    auto shared = MakeShared<int, TestType>(42);
+    EXPECT_AT_MOST_BYTES((WeakPtr<int, TestType>(shared)), 0);
+}
+
+#endif
+
+TEST_CASE("AllocateShared footprint") {
+    using Block = ControlBlockAlloc<int, RecordingAllocator<int>>;
+
+    SECTION("One block, no bigger than the allocator needs") {
+        // A stateless allocator takes no space
+        EXPECT_AT_MOST_BYTES(AllocateShared<int>(std::allocator<int>(), 42),
+                             sizeof(ControlBlockObj<int>));
+
+        AllocationRecord record;
+        {
+            auto sp = AllocateShared<int>(RecordingAllocator<int>(&record), 42);
+            REQUIRE(record.allocations == 1);
+            REQUIRE(record.bytes == sizeof(Block));
+            REQUIRE(record.live_bytes == sizeof(Block));
+        }
+        REQUIRE(record.live_bytes == 0);
+        REQUIRE(record.peak_bytes == sizeof(Block));
+    }
+
+    SECTION("Weak references keep the block") {
+        AllocationRecord record;
+        WeakPtr<int> wp;
+        {
+            auto sp = AllocateShared<int>(RecordingAllocator<int>(&record), 42);
+            wp = sp;
+        }
+        REQUIRE(record.live_bytes == sizeof(Block));
+        wp.Reset();
+        REQUIRE(record.live_bytes == 0);
+    }
+
+    SECTION("Peak of many blocks") {
+        constexpr size_t kBlocks = 100;
+        AllocationRecord record;
+        {
+            std::vector<SharedPtr<int>> pointers;
+            for (size_t i = 0; i < kBlocks; ++i) {
+                pointers.push_back(AllocateShared<int>(RecordingAllocator<int>(&record), 42));
+            }
+        }
+        REQUIRE(record.allocations == kBlocks);
+        REQUIRE(record.peak_bytes == kBlocks * sizeof(Block));
+        REQUIRE(record.largest == sizeof(Block));
+        // All in one size class
+        REQUIRE(record.size_classes[AllocationRecord::SizeClass(sizeof(Block))] == kBlocks);
+    }
+
+    SECTION("Over-aligned objects") {
+        struct alignas(64) Aligned {
+            char data[64];
+        };
+        AllocationRecord record;
+        auto sp = AllocateShared<Aligned>(RecordingAllocator<Aligned>(&record));
+        REQUIRE(record.max_align == 64);
+        REQUIRE(reinterpret_cast<uintptr_t>(sp.Get()) % 64 == 0);
+        // The allocator is stored next to the object, so it can't use the padding after the
+        // counters and costs a whole alignment unit more than `MakeShared`
+        REQUIRE(sizeof(ControlBlockObj<Aligned>) == 2 * sizeof(Aligned));
+        EXPECT_NO_ALLOCATION_LARGER_THAN(AllocateShared<Aligned>(std::allocator<Aligned>()),
+                                         sizeof(ControlBlockObj<Aligned>) + alignof(Aligned));
+    }
+}
@@ -0,0 +1,150 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <common/live_registry.h>
+#include <intrusive/intrusive.h>
+
+#include <catch.hpp>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Built with SMART_PTRS_REGISTRY defined
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Tracked {
+    char payload[100] = {};
+};
+
+struct TrackedIntrusive : SimpleRefCounted<TrackedIntrusive> {};
+
+struct TrackedWithWeak : RefCountedWithWeak<TrackedWithWeak> {};
+
+bool EndsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() &&
+           text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::vector<LiveEntry> LiveOf(const std::string& type) {
+    std::vector<LiveEntry> entries;
+    LiveRegistry::ForEachLive([&](const LiveEntry& entry) {
+        if (EndsWith(entry.type, type)) {
+            entries.push_back(entry);
+        }
+    });
+    return entries;
+}
+
+}  // namespace
+
+TEST_CASE("Live control blocks") {
+    SECTION("Blocks are listed while allocated") {
+        auto first = MakeShared<Tracked>();
+        auto copy = first;
+        SharedPtr<Tracked> adopted(new Tracked);
+        auto entries = LiveOf("Tracked");
+        REQUIRE(entries.size() == 2);
+        size_t strong = entries[0].strong + entries[1].strong;
+        REQUIRE(strong == 3);
+        for (const auto& entry : entries) {
+            REQUIRE(entry.bytes >= sizeof(Tracked));
+            REQUIRE(entry.site == nullptr);
+        }
+
+        first.Reset();
+        copy.Reset();
+        adopted.Reset();
+        REQUIRE(LiveOf("Tracked").empty());
+    }
+
+    SECTION("Weak references keep the block") {
+        WeakPtr<Tracked> weak;
+        {
+            auto shared = MakeShared<Tracked>();
+            weak = shared;
+            auto entries = LiveOf("Tracked");
+            REQUIRE(entries.size() == 1);
+            REQUIRE(entries[0].strong == 1);
+            REQUIRE(entries[0].weak == 1);
+        }
+        auto entries = LiveOf("Tracked");
+        REQUIRE(entries.size() == 1);
+        REQUIRE(entries[0].strong == 0);
+        REQUIRE(entries[0].weak == 1);
+        weak.Reset();
+        REQUIRE(LiveOf("Tracked").empty());
+    }
+
+    SECTION("Arrays") {
+        auto array = MakeShared<Tracked[]>(10);
+        auto entries = LiveOf("Tracked");
+        REQUIRE(entries.size() == 1);
+        REQUIRE(entries[0].bytes >= 10 * sizeof(Tracked));
+    }
+
+    SECTION("Allocation sites") {
+        SharedPtr<Tracked> tagged;
+        {
+            LiveSite site("loader");
+            tagged = MakeShared<Tracked>();
+        }
+        auto untagged = MakeShared<Tracked>();
+        auto entries = LiveOf("Tracked");
+        REQUIRE(entries.size() == 2);
+        size_t tagged_count = 0;
+        for (const auto& entry : entries) {
+            if (entry.site && std::strcmp(entry.site, "loader") == 0) {
+                ++tagged_count;
+            } else {
+                REQUIRE(entry.site == nullptr);
+            }
+        }
+        REQUIRE(tagged_count == 1);
+    }
+
+    SECTION("Many threads") {
+        constexpr int kThreads = 4;
+        constexpr int kBlocks = 1000;
+        std::vector<SharedPtr<Tracked, AtomicCounter>> kept(kThreads);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&kept, i] {
+                for (int j = 0; j < kBlocks; ++j) {
+                    kept[i] = MakeShared<Tracked, AtomicCounter>();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(LiveOf("Tracked").size() == kThreads);
+    }
+}
+
+TEST_CASE("Live RefCounted objects") {
+    auto object = MakeIntrusive<TrackedIntrusive>();
+    auto copy = object;
+    auto with_weak = MakeIntrusive<TrackedWithWeak>();
+    IntrusiveWeakPtr<TrackedWithWeak> weak(with_weak);
+
+    auto entries = LiveOf("TrackedIntrusive");
+    REQUIRE(entries.size() == 1);
+    REQUIRE(entries[0].strong == 2);
+    REQUIRE(entries[0].bytes == sizeof(TrackedIntrusive));
+
+    entries = LiveOf("TrackedWithWeak");
+    REQUIRE(entries.size() == 1);
+    REQUIRE(entries[0].strong == 1);
+    REQUIRE(entries[0].weak == 1);
+
+    object.Reset();
+    copy.Reset();
+    with_weak.Reset();
+    REQUIRE(LiveOf("TrackedIntrusive").empty());
+    REQUIRE(LiveOf("TrackedWithWeak").empty());
+}
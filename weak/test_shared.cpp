@@ -1,10 +1,19 @@
 #include "shared.h"
+#include "weak.h"
+
+#include <common/my_int.h>
+#include <unique/deleters.h>
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -467,3 +476,333 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Arena {
+    alignas(std::max_align_t) char buffer[1024];
+    size_t used = 0;
+    int live_allocations = 0;
+};
+
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator(Arena* arena) : arena(arena) {
+    }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        size_t start = (arena->used + alignof(T) - 1) / alignof(T) * alignof(T);
+        arena->used = start + n * sizeof(T);
+        ++arena->live_allocations;
+        return reinterpret_cast<T*>(arena->buffer + start);
+    }
+    void deallocate(T*, size_t) {
+        --arena->live_allocations;
+    }
+
+    Arena* arena;
+};
+
+TEST_CASE("AllocateShared") {
+    SECTION("Memory comes from the allocator") {
+        Arena arena;
+        ArenaAllocator<int> alloc(&arena);
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*AllocateShared<int>(alloc, 42) == 42));
+        REQUIRE(arena.used > 0);
+        REQUIRE(arena.live_allocations == 0);
+    }
+
+    SECTION("Block outlives the object") {
+        Arena arena;
+        Data::data_was_deleted = false;
+        {
+            WeakPtr<Data> wp;
+            {
+                auto sp = AllocateShared<Data>(ArenaAllocator<Data>(&arena));
+                wp = sp;
+            }
+            REQUIRE(Data::data_was_deleted);
+            REQUIRE(arena.live_allocations == 1);
+        }
+        REQUIRE(arena.live_allocations == 0);
+    }
+
+    SECTION("Faulty constructor") {
+        Arena arena;
+        REQUIRE_THROWS(AllocateShared<Throwing>(ArenaAllocator<Throwing>(&arena)));
+        REQUIRE(arena.live_allocations == 0);
+    }
+
+    SECTION("Stateless allocator takes no space") {
+        REQUIRE(sizeof(ControlBlockAlloc<int, std::allocator<int>>) == sizeof(ControlBlockObj<int>));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct CountingDeleter {
+    void operator()(int* ptr) const {
+        delete ptr;
+        ++calls;
+    }
+
+    inline static int calls = 0;
+};
+
+TEST_CASE("Custom deleter") {
+    SECTION("Called once by the last owner") {
+        CountingDeleter::calls = 0;
+        {
+            SharedPtr<int> a(new int(42), CountingDeleter{});
+            SharedPtr<int> b = a;
+            WeakPtr<int> w(a);
+            a.Reset();
+            REQUIRE(CountingDeleter::calls == 0);
+            b.Reset();
+            REQUIRE(CountingDeleter::calls == 1);
+        }
+        REQUIRE(CountingDeleter::calls == 1);
+    }
+
+    SECTION("Reset") {
+        CountingDeleter::calls = 0;
+        SharedPtr<int> a(new int(1), CountingDeleter{});
+        a.Reset(new int(2), CountingDeleter{});
+        REQUIRE(CountingDeleter::calls == 1);
+        REQUIRE(*a == 2);
+        a.Reset();
+        REQUIRE(CountingDeleter::calls == 2);
+    }
+
+    SECTION("Stateful deleter") {
+        int released = 0;
+        int value = 42;
+        {
+            SharedPtr<int> a(&value, [&released](int* ptr) { released = *ptr; });
+        }
+        REQUIRE(released == 42);
+    }
+
+    SECTION("Move-only deleter") {
+        SharedPtr<int> a(new int(42), Deleter<int>(7));
+        REQUIRE(*a == 42);
+    }
+
+    SECTION("Stateless deleter takes no space") {
+        REQUIRE(sizeof(ControlBlockPtr<int, SingleThreadCounter, CountingDeleter>) ==
+                sizeof(ControlBlockPtr<int>));
+    }
+}
+
+TEST_CASE("From UniquePtr") {
+    SECTION("Default deleter") {
+        UniquePtr<MyInt> unique(new MyInt(42));
+        MyInt* raw = unique.Get();
+        SharedPtr<MyInt> shared(std::move(unique));
+        REQUIRE(shared.Get() == raw);
+        REQUIRE(!unique);
+        REQUIRE(shared.UseCount() == 1);
+        shared.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Deleter moves into the block") {
+        Deleter<int> deleter(7);
+        UniquePtr<int, Deleter<int>> unique(new int(42), std::move(deleter));
+        SharedPtr<int> shared(std::move(unique));
+        REQUIRE(unique.GetDeleter().GetTag() == 0);
+        auto block = static_cast<ControlBlockPtr<int, SingleThreadCounter, Deleter<int>>*>(
+            shared.block_);
+        REQUIRE(block->ptr_and_del.GetSecond().GetTag() == 7);
+    }
+
+    SECTION("Deleter is called once") {
+        CountingDeleter::calls = 0;
+        {
+            UniquePtr<int, CountingDeleter> unique(new int(42));
+            SharedPtr<int> shared;
+            shared = std::move(unique);
+            auto copy = shared;
+            REQUIRE(copy.UseCount() == 2);
+        }
+        REQUIRE(CountingDeleter::calls == 1);
+    }
+
+    SECTION("Arrays") {
+        UniquePtr<MyInt[]> unique(new MyInt[3]);
+        SharedPtr<MyInt[]> shared(std::move(unique));
+        REQUIRE(MyInt::AliveCount() == 3);
+        shared.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Empty") {
+        UniquePtr<int> unique;
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int> shared(std::move(unique)));
+    }
+
+    SECTION("One allocation") {
+        UniquePtr<int> unique(new int(1));
+        EXPECT_ONE_ALLOCATION(SharedPtr<int> shared(std::move(unique)));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct alignas(64) OverAligned {
+    int value = 7;
+};
+
+TEST_CASE("Arrays") {
+    SECTION("Owning new[]") {
+        SharedPtr<MyInt[]> a(new MyInt[3]);
+        REQUIRE(MyInt::AliveCount() == 3);
+        a.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("MakeShared in one allocation") {
+        EXPECT_ONE_ALLOCATION(auto a = MakeShared<int[]>(100); REQUIRE(a[0] == 0);
+                              REQUIRE(a[99] == 0));
+        WeakPtr<MyInt[]> w;
+        {
+            auto a = MakeShared<MyInt[]>(5);
+            REQUIRE(MyInt::AliveCount() == 5);
+            w = a;
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(w.Expired());
+    }
+
+    SECTION("Elements are laid out in place") {
+        auto a = MakeShared<OverAligned[]>(4);
+        REQUIRE(reinterpret_cast<uintptr_t>(a.Get()) % 64 == 0);
+        for (size_t i = 0; i < 4; ++i) {
+            REQUIRE(a[i].value == 7);
+        }
+    }
+
+    SECTION("For overwrite") {
+        auto a = MakeSharedForOverwrite<int[]>(1000);
+        for (int i = 0; i < 1000; ++i) {
+            a[i] = i;
+        }
+        REQUIRE(a[999] == 999);
+        auto strings = MakeSharedForOverwrite<std::string[]>(2);
+        REQUIRE(strings[1].empty());
+    }
+
+    SECTION("Faulty constructor") {
+        REQUIRE_THROWS(MakeShared<Throwing[]>(3));
+    }
+
+    SECTION("Size too big for memory") {
+        constexpr size_t kHuge = SIZE_MAX / sizeof(int) + 1;
+        REQUIRE_THROWS_AS(MakeSharedForOverwrite<int[]>(kHuge), std::bad_array_new_length);
+        REQUIRE_THROWS_AS(MakeShared<int[]>(kHuge), std::bad_array_new_length);
+        // Fits in `size_t` only without the block in front
+        REQUIRE_THROWS_AS(MakeShared<int[]>(SIZE_MAX / sizeof(int)), std::bad_array_new_length);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Comparisons") {
+    auto a = MakeShared<int>(1);
+    auto b = MakeShared<int>(1);
+    SharedPtr<int> a_copy = a;
+    REQUIRE(a == a_copy);
+    REQUIRE(a != b);
+    REQUIRE(SharedPtr<int>() == SharedPtr<int>(nullptr));
+}
+
+struct Pair {
+    int first;
+    int second;
+};
+
+TEST_CASE("Owner-based keys") {
+    auto pair = MakeShared<Pair>(Pair{1, 2});
+    SharedPtr<int> first(pair, &pair->first);
+    SharedPtr<int> second(pair, &pair->second);
+    WeakPtr<int> weak(first);
+    auto other = MakeShared<int>(3);
+
+    SECTION("Aliases are one owner") {
+        REQUIRE(first != second);
+        REQUIRE(OwnerEqual{}(first, second));
+        REQUIRE(OwnerEqual{}(pair, weak));
+        REQUIRE(OwnerHash{}(first) == OwnerHash{}(weak));
+        REQUIRE(!OwnerEqual{}(first, other));
+        REQUIRE(OwnerLess{}(first, other) != OwnerLess{}(other, weak));
+        REQUIRE(!OwnerLess{}(first, weak));
+        REQUIRE(!OwnerLess{}(weak, first));
+    }
+
+    SECTION("Side table keyed by weak pointers") {
+        std::unordered_map<WeakPtr<int>, std::string, OwnerHash, OwnerEqual> names;
+        names[weak] = "pair";
+        names[WeakPtr<int>(other)] = "other";
+        REQUIRE(names.at(WeakPtr<int>(second)) == "pair");
+        REQUIRE(names.size() == 2);
+
+        // Keys stay usable after their objects are gone, and do not keep them alive
+        pair.Reset();
+        first.Reset();
+        second.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(names.at(weak) == "pair");
+    }
+
+    SECTION("std::hash") {
+        std::unordered_set<SharedPtr<int>> values = {first, other, first};
+        REQUIRE(values.size() == 2);
+        REQUIRE(std::hash<WeakPtr<int>>{}(weak) == OwnerHash{}(second));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Constant-initialized, no constructor runs at startup
+ImmortalControlBlock<> immortal_block;
+ImmortalControlBlock<AtomicCounter> immortal_atomic_block;
+const std::string kImmortalName = "global";
+int immortal_value = 42;
+
+static_assert((ImmortalControlBlock<PackedCounter>(), true));
+
+TEST_CASE("Immortal") {
+    SECTION("No counter traffic") {
+        auto ptr = MakeImmortal(&immortal_value, &immortal_block);
+        {
+            auto copy = ptr;
+            WeakPtr<int> weak(copy);
+            REQUIRE(*weak.Lock() == 42);
+            SharedPtr<int> promoted(weak);
+        }
+        REQUIRE(immortal_block.GetSharedCnt() == 1);
+        REQUIRE(immortal_block.GetWeakCnt() == 0);
+        ptr.Reset();
+        REQUIRE(immortal_value == 42);
+    }
+
+    SECTION("Never expires") {
+        WeakPtr<const std::string, AtomicCounter> weak;
+        {
+            auto ptr = MakeImmortal(&kImmortalName, &immortal_atomic_block);
+            weak = ptr;
+        }
+        REQUIRE(!weak.Expired());
+        REQUIRE(*weak.Lock() == "global");
+    }
+
+    SECTION("No allocations") {
+        EXPECT_ZERO_ALLOCATIONS(auto ptr = MakeImmortal(&immortal_value, &immortal_block);
+                                auto copy = ptr;);
+    }
+}
@@ -0,0 +1,107 @@
+#include "thin_shared.h"
+
+#include <common/my_int.h>
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Thin pointers are one word") {
+    REQUIRE(sizeof(ThinSharedPtr<std::string>) == sizeof(void*));
+    REQUIRE(sizeof(ThinWeakPtr<std::string>) == sizeof(void*));
+    REQUIRE(sizeof(ThinSharedPtr<std::string, AtomicCounter>) == sizeof(void*));
+}
+
+TEST_CASE("ThinSharedPtr") {
+    SECTION("Ownership") {
+        {
+            EXPECT_ONE_ALLOCATION(auto ptr = MakeThinShared<MyInt>(42));
+            auto ptr = MakeThinShared<MyInt>(42);
+            auto copy = ptr;
+            REQUIRE(*copy == 42);
+            REQUIRE(ptr.UseCount() == 2);
+            ThinSharedPtr<MyInt> moved(std::move(copy));
+            REQUIRE(!copy);
+            REQUIRE(moved.Get() == ptr.Get());
+            moved.Reset();
+            REQUIRE(ptr.UseCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Arrays of pointers") {
+        auto node = MakeThinShared<std::string>("node");
+        std::vector<ThinSharedPtr<std::string>> edges(8, node);
+        REQUIRE(node.UseCount() == 9);
+        REQUIRE(*edges[3] == "node");
+        REQUIRE(edges[5]->size() == 4);
+    }
+
+    SECTION("Empty") {
+        ThinSharedPtr<int> empty;
+        REQUIRE(!empty);
+        REQUIRE(empty.Get() == nullptr);
+        REQUIRE(empty.UseCount() == 0);
+        SharedPtr<int> shared = empty;
+        REQUIRE(!shared);
+    }
+}
+
+struct ThinBase {
+    virtual ~ThinBase() = default;
+    int base = 1;
+};
+struct ThinDerived : ThinBase {
+    int derived = 2;
+};
+
+TEST_CASE("Conversion to SharedPtr") {
+    auto thin = MakeThinShared<ThinDerived>();
+    SharedPtr<ThinDerived> shared = thin;
+    REQUIRE(shared.Get() == thin.Get());
+    REQUIRE(thin.UseCount() == 2);
+
+    SharedPtr<ThinBase> base = thin;
+    REQUIRE(base.Get() == thin.Get());
+    SharedPtr<int> alias(shared, &shared->derived);
+    REQUIRE(*alias == 2);
+    REQUIRE(thin.UseCount() == 4);
+
+    EXPECT_ZERO_ALLOCATIONS(SharedPtr<ThinDerived> moved = std::move(thin));
+    REQUIRE(!thin);
+    REQUIRE(shared.UseCount() == 3);
+}
+
+TEST_CASE("ThinWeakPtr") {
+    ThinWeakPtr<MyInt> weak;
+    REQUIRE(weak.Expired());
+    REQUIRE(!weak.Lock());
+    {
+        auto thin = MakeThinShared<MyInt>(7);
+        weak = thin;
+        REQUIRE(weak.UseCount() == 1);
+        REQUIRE(*weak.Lock() == 7);
+        WeakPtr<MyInt> full = weak;
+        REQUIRE(full.Lock().Get() == thin.Get());
+    }
+    REQUIRE(weak.Expired());
+    REQUIRE(!weak.Lock());
+    WeakPtr<MyInt> full = weak;
+    REQUIRE(full.Expired());
+    REQUIRE(MyInt::AliveCount() == 0);
+}
+
+struct ThinNode : EnableSharedFromThis<ThinNode> {
+};
+
+TEST_CASE("Thin pointers enable SharedFromThis") {
+    auto node = MakeThinShared<ThinNode>();
+    auto self = node->SharedFromThis();
+    REQUIRE(self.Get() == node.Get());
+    REQUIRE(node.UseCount() == 2);
+}
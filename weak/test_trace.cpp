@@ -0,0 +1,100 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <intrusive/intrusive.h>
+
+#include <catch.hpp>
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Traced {
+    int value = 0;
+};
+
+struct TracedIntrusive : SimpleRefCounted<TracedIntrusive> {};
+
+RefTrace::TypeStats StatsFor(const std::string& type) {
+    for (const auto& stats : RefTrace::GetStats()) {
+        // Demangled names may carry a namespace prefix
+        if (stats.type.size() >= type.size() &&
+            stats.type.compare(stats.type.size() - type.size(), type.size(), type) == 0) {
+            return stats;
+        }
+    }
+    return {type};
+}
+
+}  // namespace
+
+TEST_CASE("Trace SharedPtr and WeakPtr") {
+    {
+        auto first = MakeShared<Traced>();
+        auto second = first;
+        auto third = std::move(second);
+        WeakPtr<Traced> weak = first;
+        REQUIRE(weak.Lock());
+        first.Reset();
+        third.Reset();
+        REQUIRE(!weak.Lock());
+    }
+
+    auto stats = StatsFor("Traced");
+    REQUIRE(stats[TraceEvent::kConstruct] == 1);
+    REQUIRE(stats[TraceEvent::kCopy] == 1);
+    REQUIRE(stats[TraceEvent::kMove] == 1);
+    // Copy, weak from shared, one successful lock
+    REQUIRE(stats[TraceEvent::kIncrement] == 3);
+    // Two strong resets, the locked copy, the weak pointer
+    REQUIRE(stats[TraceEvent::kDecrement] == 4);
+    REQUIRE(stats[TraceEvent::kLock] == 2);
+    REQUIRE(stats[TraceEvent::kLockFailure] == 1);
+}
+
+TEST_CASE("Trace const pointees in the same row") {
+    struct TracedConst {};
+    {
+        auto mutable_ptr = MakeShared<TracedConst>();
+        SharedPtr<const TracedConst> const_ptr = mutable_ptr;
+        auto copy = const_ptr;
+    }
+
+    size_t rows = 0;
+    for (const auto& stats : RefTrace::GetStats()) {
+        rows += stats.type.find("TracedConst") != std::string::npos;
+    }
+    REQUIRE(rows == 1);
+    auto stats = StatsFor("TracedConst");
+    REQUIRE(stats[TraceEvent::kConstruct] == 1);
+    REQUIRE(stats[TraceEvent::kCopy] == 2);
+}
+
+TEST_CASE("Trace IntrusivePtr from several threads") {
+    constexpr int kCopies = 1000;
+    auto ptr = MakeIntrusive<TracedIntrusive>();
+    auto copy_many = [&ptr] {
+        for (int i = 0; i < kCopies; ++i) {
+            IntrusivePtr<TracedIntrusive> copy(ptr);
+        }
+    };
+    std::thread thread(copy_many);
+    thread.join();
+    copy_many();
+
+    // The exited thread's counts are kept
+    auto stats = StatsFor("TracedIntrusive");
+    REQUIRE(stats[TraceEvent::kConstruct] == 1);
+    REQUIRE(stats[TraceEvent::kCopy] == 2 * kCopies);
+    REQUIRE(stats[TraceEvent::kIncrement] == 2 * kCopies + 1);
+    REQUIRE(stats[TraceEvent::kDecrement] == 2 * kCopies);
+
+    std::ostringstream out;
+    RefTrace::DumpStats(out);
+    REQUIRE(out.str().find("increment") != std::string::npos);
+    REQUIRE(out.str().find("TracedIntrusive") != std::string::npos);
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <type_traits>
+#include <utility>
+
+// One-word pointers to objects made by `MakeThinShared`. The object always sits at the same
+// offset inside its `ControlBlockObj`, so only the block is stored and the object address is
+// computed from it. Convert to `SharedPtr`/`WeakPtr` for aliasing or type conversions.
+template <typename T, typename Counter = SingleThreadCounter>
+class ThinSharedPtr {
+public:
+    using Block = ControlBlockObj<T, Counter>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinSharedPtr() : block_(nullptr) {
+    }
+    ThinSharedPtr(std::nullptr_t) : block_(nullptr) {
+    }
+    // Adopts a strong reference that the caller already holds
+    explicit ThinSharedPtr(Block* block) : block_(block) {
+    }
+    ThinSharedPtr(const ThinSharedPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncSharedCnt();
+        }
+    }
+    ThinSharedPtr(ThinSharedPtr&& other) : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinSharedPtr& operator=(const ThinSharedPtr& other) {
+        ThinSharedPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinSharedPtr& operator=(ThinSharedPtr&& other) {
+        ThinSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinSharedPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (block_) {
+            std::exchange(block_, nullptr)->DecSharedCnt();
+        }
+    }
+    void Swap(ThinSharedPtr& other) {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        return block_ ? block_->GetPtr() : nullptr;
+    }
+    T& operator*() const {
+        return *block_->GetPtr();
+    }
+    T* operator->() const {
+        return block_->GetPtr();
+    }
+    size_t UseCount() const {
+        return block_ ? block_->GetSharedCnt() : 0;
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversions
+
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<T*, Y*>>>
+    operator SharedPtr<Y, Counter>() const& {
+        return ThinSharedPtr(*this).template ToShared<Y>();
+    }
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<T*, Y*>>>
+    operator SharedPtr<Y, Counter>() && {
+        return ToShared<Y>();
+    }
+
+    Block* block_;
+
+private:
+    // Hands our reference over to the result
+    template <typename Y>
+    SharedPtr<Y, Counter> ToShared() {
+        SharedPtr<Y, Counter> shared;
+        shared.ptr_ = Get();
+        shared.block_ = std::exchange(block_, nullptr);
+        return shared;
+    }
+};
+
+template <typename T, typename Counter = SingleThreadCounter>
+class ThinWeakPtr {
+public:
+    using Block = ControlBlockObj<T, Counter>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinWeakPtr() : block_(nullptr) {
+    }
+    ThinWeakPtr(const ThinSharedPtr<T, Counter>& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncWeakCnt();
+        }
+    }
+    ThinWeakPtr(const ThinWeakPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncWeakCnt();
+        }
+    }
+    ThinWeakPtr(ThinWeakPtr&& other) : block_(std::exchange(other.block_, nullptr)) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinWeakPtr& operator=(const ThinWeakPtr& other) {
+        ThinWeakPtr(other).Swap(*this);
+        return *this;
+    }
+    ThinWeakPtr& operator=(ThinWeakPtr&& other) {
+        ThinWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinWeakPtr() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        if (block_) {
+            std::exchange(block_, nullptr)->DecWeakCnt();
+        }
+    }
+    void Swap(ThinWeakPtr& other) {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const {
+        return block_ ? block_->GetSharedCnt() : 0;
+    }
+    bool Expired() const {
+        return UseCount() == 0;
+    }
+    ThinSharedPtr<T, Counter> Lock() const {
+        if (block_ && block_->TryIncSharedCnt()) {
+            return ThinSharedPtr<T, Counter>(block_);
+        }
+        return ThinSharedPtr<T, Counter>();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversions
+
+    // The object may be gone already, so its address is computed without touching it
+    operator WeakPtr<T, Counter>() const {
+        WeakPtr<T, Counter> weak;
+        if (block_) {
+            block_->IncWeakCnt();
+            weak.block_ = block_;
+            weak.ptr_ = block_->GetPtr();
+        }
+        return weak;
+    }
+
+    Block* block_;
+};
+
+// Same as `MakeShared`, for a one-word pointer
+template <typename T, typename Counter = SingleThreadCounter, typename... Args>
+ThinSharedPtr<T, Counter> MakeThinShared(Args&&... args) {
+    auto new_block = new ControlBlockObj<T, Counter>(std::forward<Args>(args)...);
+    AdoptObject<Counter>(new_block, new_block->GetPtr());
+    return ThinSharedPtr<T, Counter>(new_block);
+}
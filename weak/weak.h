@@ -1,32 +1,47 @@
 #pragma once
 
 #include "sw_fwd.h"  // Forward declaration
+
+#include <common/ref_trace.h>
+
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Counter>
 class WeakPtr {
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
-    BaseControlBlock* block_;
-    T* ptr_;
+    BaseControlBlock<Counter>* block_;
+    std::remove_extent_t<T>* ptr_;
     WeakPtr() : block_(nullptr), ptr_(nullptr){};
 
     WeakPtr(const WeakPtr& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         block_ = other.block_;
         ptr_ = other.ptr_;
         if (other.block_) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
             block_->IncWeakCnt();
         }
     };
+    template <typename Y>
+    WeakPtr(const WeakPtr<Y, Counter>& other) : block_(other.block_), ptr_(other.ptr_) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
+        if (block_) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
+            block_->IncWeakCnt();
+        }
+    }
     WeakPtr(WeakPtr&& other) : block_(other.block_), ptr_(other.ptr_) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         other.block_ = nullptr;
         other.ptr_ = nullptr;
     };
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) : block_(other.block_), ptr_(other.ptr_) {
+    WeakPtr(const SharedPtr<T, Counter>& other) : block_(other.block_), ptr_(other.ptr_) {
         if (block_) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
             block_->IncWeakCnt();
         }
     };
@@ -35,12 +50,14 @@ public:
     // `operator=`-s
 
     WeakPtr& operator=(const WeakPtr& other) {
+        SMART_PTRS_TRACE_EVENT(T, kCopy);
         if (other.block_ != nullptr) {
             if (block_ != other.block_) {
                 Reset();
                 ptr_ = other.ptr_;
                 block_ = other.block_;
-                block_->IncSharedCnt();
+                SMART_PTRS_TRACE_EVENT(T, kIncrement);
+                block_->IncWeakCnt();
             }
         } else {
             Reset();
@@ -48,6 +65,7 @@ public:
         return *this;
     };
     WeakPtr& operator=(WeakPtr&& other) {
+        SMART_PTRS_TRACE_EVENT(T, kMove);
         std::swap(ptr_, other.ptr_);
         std::swap(block_, other.block_);
         return *this;
@@ -65,10 +83,8 @@ public:
 
     void Reset() {
         if (block_) {
+            SMART_PTRS_TRACE_EVENT(T, kDecrement);
             block_->DecWeakCnt();
-            if (!(block_->GetSharedCnt() || block_->GetWeakCnt())) {
-                delete block_;
-            }
             block_ = nullptr;
             ptr_ = nullptr;
         }
@@ -93,14 +109,17 @@ public:
         }
         return true;
     };
-    SharedPtr<T> Lock() const {
-        if (Expired()) {
-            return SharedPtr<T>();
+    // Safe to race with the last `SharedPtr` going away: either wins, the object never comes back
+    SharedPtr<T, Counter> Lock() const {
+        SMART_PTRS_TRACE_EVENT(T, kLock);
+        SharedPtr<T, Counter> new_ptr;
+        if (block_ && block_->TryIncSharedCnt()) {
+            SMART_PTRS_TRACE_EVENT(T, kIncrement);
+            new_ptr.block_ = block_;
+            new_ptr.ptr_ = ptr_;
+        } else {
+            SMART_PTRS_TRACE_EVENT(T, kLockFailure);
         }
-        SharedPtr<T> new_ptr;
-        new_ptr.block_ = block_;
-        new_ptr.ptr_ = ptr_;
-        block_->IncSharedCnt();
         return new_ptr;
     };
 };
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// Map from keys to objects that the cache does not keep alive: it hands out `SharedPtr`s to
+// whatever is still in use and creates the rest on demand.
+//
+// Keys are spread over independently locked shards. Entries whose objects are gone are not
+// removed all at once: every operation on a shard also checks a few more of its buckets,
+// going round the table, so dead entries are found after about as many operations as there
+// are buckets and no call ever walks the whole map.
+template <typename K, typename V, typename Counter = AtomicCounter, typename Hash = std::hash<K>>
+class WeakValueCache {
+public:
+    static constexpr size_t kDefaultShards = 16;
+    // Entries and empty buckets looked at by a single operation
+    static constexpr size_t kSweepBudget = 4;
+
+    // A `shard_count` of 0 is taken as 1
+    explicit WeakValueCache(size_t shard_count = kDefaultShards)
+        : shards_(new Shard[std::max<size_t>(shard_count, 1)]),
+          shard_count_(std::max<size_t>(shard_count, 1)) {
+    }
+
+    // Returns the live object for `key`, or an empty pointer
+    SharedPtr<V, Counter> Get(const K& key) {
+        Shard& shard = GetShard(key);
+        std::lock_guard lock(shard.mutex);
+        Sweep(shard);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end()) {
+            return SharedPtr<V, Counter>();
+        }
+        return it->second.Lock();
+    }
+
+    // Returns the live object for `key`, or the one made by `factory()` (which returns a
+    // `SharedPtr<V, Counter>`). The factory runs with the shard locked, so concurrent misses on
+    // one key create a single object; it must not call back into the cache.
+    template <typename Factory>
+    SharedPtr<V, Counter> GetOrCreate(const K& key, Factory&& factory) {
+        Shard& shard = GetShard(key);
+        std::lock_guard lock(shard.mutex);
+        Sweep(shard);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end()) {
+            if (auto value = it->second.Lock()) {
+                return value;
+            }
+        }
+        SharedPtr<V, Counter> value = std::forward<Factory>(factory)();
+        if (!value) {
+            return value;
+        }
+        if (it != shard.map.end()) {
+            it->second = WeakPtr<V, Counter>(value);
+        } else {
+            shard.map.emplace(key, WeakPtr<V, Counter>(value));
+        }
+        return value;
+    }
+
+    void Erase(const K& key) {
+        Shard& shard = GetShard(key);
+        std::lock_guard lock(shard.mutex);
+        shard.map.erase(key);
+        Sweep(shard);
+    }
+
+    // Entries over all shards, including expired ones that have not been swept yet
+    size_t Size() const {
+        size_t size = 0;
+        for (size_t i = 0; i < shard_count_; ++i) {
+            std::lock_guard lock(shards_[i].mutex);
+            size += shards_[i].map.size();
+        }
+        return size;
+    }
+
+private:
+    struct Shard {
+        mutable std::mutex mutex;
+        std::unordered_map<K, WeakPtr<V, Counter>, Hash> map;
+        size_t next_bucket = 0;
+        size_t next_entry = 0;  // Entries of `next_bucket` already looked at
+    };
+
+    Shard& GetShard(const K& key) {
+        // The maps use the low bits of the same hash, pick the shard by the high ones
+        uint64_t hash = static_cast<uint64_t>(Hash{}(key)) * 0x9E3779B97F4A7C15;
+        return shards_[(hash >> 32) % shard_count_];
+    }
+
+    // Looks at up to `kSweepBudget` entries or empty buckets from where the last call stopped,
+    // which may be partway through a bucket
+    static void Sweep(Shard& shard) {
+        auto& map = shard.map;
+        size_t budget = kSweepBudget;
+        while (budget && !map.empty()) {
+            size_t bucket = shard.next_bucket % map.bucket_count();
+            if (map.begin(bucket) == map.end(bucket)) {
+                --budget;
+                shard.next_bucket = bucket + 1;
+                shard.next_entry = 0;
+                continue;
+            }
+            // Skipping the entries already looked at costs no more than a lookup in the bucket
+            auto it = map.begin(bucket);
+            for (size_t i = 0; i < shard.next_entry && it != map.end(bucket); ++i) {
+                ++it;
+            }
+            for (; it != map.end(bucket) && budget; ++it) {
+                --budget;
+                if (it->second.Expired()) {
+                    break;
+                }
+                ++shard.next_entry;
+            }
+            if (it != map.end(bucket) && it->second.Expired()) {
+                // The entries after it move up, stay where we are
+                map.erase(map.find(it->first));
+                continue;
+            }
+            if (it == map.end(bucket)) {
+                shard.next_bucket = bucket + 1;
+                shard.next_entry = 0;
+            }
+        }
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t shard_count_;
+};